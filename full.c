@@ -1,39 +1,218 @@
+// Build: gcc -O2 -pthread full.c -o railway   (add -fopenmp for the parallel passes)
+#define _POSIX_C_SOURCE 200809L // clock_gettime and nanosleep under -std=c11
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "railway.h"
 
-#define MAX_TRAINS 32
-#define MAX_TRACKS 64
+#define MAX_TRAINS RAILWAY_MAX_TRAINS
+#define MAX_TRACKS RAILWAY_MAX_TRACKS
 #define MAX_NAME_LEN 32
+#define NAME_POOL_BYTES 8192    // Interned name storage, reset on every scenario load
+#define NAME_HASH_SLOTS 512     // Power of two, well above MAX_TRAINS + MAX_TRACKS
 #define MAX_CHECKPOINTS 16
+#define MAX_COMPONENTS (MAX_TRAINS + MAX_TRACKS)
+#define SCENARIO_ARENA_BYTES (64u << 20) // Working memory that lives as long as a scenario
+#define SCRATCH_ARENA_BYTES (8u << 20)  // Working memory of one detection/report pass
+#define MAX_REGIONS 32          // Detection regions, one bit each in the summary graph
+#define REGION_TRACKS 8         // Default region: this many consecutive tracks
+#define MAX_ROUTE_STEPS RAILWAY_MAX_ROUTE_STEPS
+#define WHEEL_LEVELS 4          // Hierarchical timing wheel: 64^4 ticks of range
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define PENDING_MAX (1u << 18)  // Outstanding request deadlines per scenario
+#define PENDING_MAX_BOOSTS 3    // Timeouts retried with a boost before escalating to recovery
+#define MAX_LOOKAHEAD 12
+#define PREDICT_MAX_STATES RAILWAY_PREDICT_DEFAULT_STATES
+#define PREDICT_MIN_SLOTS 4096  // First lookahead table; power of two, grown fourfold as needed
+#define EXPLORE_ARENA_BYTES (512u << 20) // Model checker state store (pages are touched as used)
+#define EXPLORE_CHUNK 16384     // Frontier states expanded per parallel batch
+#define EXPLORE_MAX_STATES RAILWAY_EXPLORE_DEFAULT_STATES
+#define MAX_TRACE RAILWAY_MAX_TRACE
+#define CYCLE_BUF_LEN (MAX_TRAINS + 1) // A DFS cycle record: every train plus the closing repeat
+#define MAX_ROUTE_CANDIDATES RAILWAY_MAX_ROUTE_CANDIDATES
+#define ROUTE_DETOUR 2          // Candidate paths are at most this many tracks longer than the shortest
+#define ROUTE_SEARCH_BUDGET 4096 // Path extensions tried per routing query
+#define RING_SLOTS 1024         // Admission ring; power of two
+#define ADMIT_BATCH 64          // Mutations applied per pass of the admission thread
+#define MAX_PRODUCERS RAILWAY_MAX_PRODUCERS
+#define LOG_RING_RECORDS 4096   // Event records buffered per handle; power of two
+#define OUT_BUF_BYTES 16384     // State rendering is written out in chunks of this size
+#define STATE_PAGE_ROWS 20      // States within one page print in full, larger ones are paged
+#define STATE_PAGE_TRACKS 16
+#define SUMMARY_TOP 5           // Tracks and trains listed in the summary of a large state
+#define STRESS_MAX_OPS (1u << 19) // Round trips timed by one run of the admission stress test
 
-// ANSI Color Codes for enhanced terminal output
-static const char *C_RESET = "\x1b[0m";
-static const char *C_BOLD = "\x1b[1m";
-static const char *C_RED = "\x1b[31m";
-static const char *C_GREEN = "\x1b[32m";
-static const char *C_YELLOW = "\x1b[33m";
-static const char *C_BLUE = "\x1b[34m";
-static const char *C_MAGENTA = "\x1b[35m";
-static const char *C_CYAN = "\x1b[36m";
+// OpenMP work-sharing hints; they compile away when built without -fopenmp
+#define PRAGMA(x) _Pragma(#x)
+#ifdef _OPENMP
+#define OMP_FOR_IF(cond) PRAGMA(omp parallel for schedule(static) if (cond))
+#else
+#define OMP_FOR_IF(cond)
+#endif
+
+// Full unrolling of fixed-width row loops in the specialized kernels
+#ifdef __GNUC__
+#define UNROLL_ROW PRAGMA(GCC unroll 64)
+#else
+#define UNROLL_ROW
+#endif
+
+// Cached per-component verdicts that must be recomputed (RailwayState.comp_stale)
+#define COMP_STALE_SAFETY 1
+#define COMP_STALE_WFG    2
+#define COMP_STALE_MARGIN 4
+#define COMP_STALE_ALL    (COMP_STALE_SAFETY | COMP_STALE_WFG | COMP_STALE_MARGIN)
+
+struct KernelSet;
+
+// One upcoming move of a train: units > 0 acquires that many units of the track
+// (capped by the train's claim), units < 0 releases them. Track -1 releases
+// everything the train holds.
+typedef struct {
+    int track;
+    int units;
+} RouteStep;
+
+// Per-train denial record, updated in O(1) on every Banker's decision
+typedef struct {
+    uint16_t streak;            // Consecutive denials of valid requests
+    uint16_t worst;             // Longest streak so far
+    uint32_t since;             // Clock tick of the first denial in the streak
+} TrainWait;
 
-// Structure representing the current state of the railway system
+struct railway;
+
+// Structure representing the current state of the railway system. Rows are always
+// MAX_TRACKS wide and zero past ntracks so fixed-width kernels can read padded rows.
 typedef struct {
+    struct railway *ctx;               // Handle owning the names, arenas and wheel of this state
     int ntrains;
     int ntracks;
-    char tname[MAX_TRAINS][MAX_NAME_LEN];
-    char rname[MAX_TRACKS][MAX_NAME_LEN];
     int available[MAX_TRACKS];         // Available resource units
     int maximum[MAX_TRAINS][MAX_TRACKS];    // Max units each train may request
     int allocation[MAX_TRAINS][MAX_TRACKS]; // Currently allocated units
     int need[MAX_TRAINS][MAX_TRACKS];       // Max - Allocation
+    int need_cnt[MAX_TRAINS];               // Tracks with Need > 0, per train
+
+    // Per-track aggregates kept in step with every mutation (see set_cell).
+    // Capacity is available + track_alloc.
+    int track_alloc[MAX_TRACKS];            // Units held by all trains
+    int track_holders[MAX_TRACKS];          // Trains holding at least one unit
+    int track_need[MAX_TRACKS];             // Outstanding Need summed over trains
+    int track_waiters[MAX_TRACKS];          // Trains with Need > 0 on the track
+
+    // Track topology: bit k of track_links[j] is set if trains can run from j to k
+    uint64_t track_links[MAX_TRACKS];
+
+    // Linear signatures of each train's (Need, Allocation) row and each track's
+    // column, kept by set_cell. Equal rows (columns) have equal signatures.
+    unsigned row_sig[MAX_TRAINS];
+    unsigned col_sig[MAX_TRACKS];
+
+    // Need/Allocation copies read by the safety and WFG kernels, stored at the
+    // narrowest width (1, 2 or 4 bytes) that holds every cell of the scenario.
+    // Width 4 means the kernels read the int matrices above directly.
+    int cell_width;
+    union { uint8_t w8[MAX_TRAINS][MAX_TRACKS]; uint16_t w16[MAX_TRAINS][MAX_TRACKS]; } cneed, calloc;
+    const struct KernelSet *kern;           // Chosen for (cell_width, ntracks) at load
+
+    // Live trains in ascending id order. Slots of terminated trains go on the free
+    // list so that new trains reuse them instead of growing ntrains.
+    int nactive;
+    int active[MAX_TRAINS];
+    int active_pos[MAX_TRAINS];             // Index into active[], -1 if removed
+    int nfree;
+    int free_slots[MAX_TRAINS];
+    uint32_t train_gen[MAX_TRAINS];         // Bumped when a slot is reused by admit_train
+
+    // Connected components of the train-track claim graph. Trains in different
+    // components share no track, so safety and deadlock are decided per component.
+    int ncomp;                                      // 0 = not built yet
+    int train_comp[MAX_TRAINS];
+    int track_comp[MAX_TRACKS];
+    unsigned char comp_stale[MAX_COMPONENTS];       // COMP_STALE_* bits
+    unsigned char comp_safe[MAX_COMPONENTS];        // Cached Banker's verdict
+    unsigned char comp_deadlocked[MAX_COMPONENTS];  // Cached WFG verdict
+
+    // Safety margin: per track, a lower bound on how many units could be removed
+    // from Available before the state turns unsafe (0 on tracks of unsafe
+    // components). Valid for every component without COMP_STALE_MARGIN.
+    int headroom[MAX_TRACKS];
+
+    // Detection regions: each groups some tracks and caches its WFG fragment (the
+    // wait edges through its tracks) as train bitmasks. set_cell marks the region
+    // of the touched track stale, so only changed regions are rebuilt.
+    int nregions;
+    int track_region[MAX_TRACKS];
+    unsigned char region_stale[MAX_REGIONS];
+    unsigned char region_deadlocked[MAX_REGIONS];   // Cycle inside the fragment alone
+    uint32_t region_adj[MAX_REGIONS][MAX_TRAINS];   // Fragment adjacency rows
+    uint32_t region_targets[MAX_REGIONS];           // Trains waited on through the region
+    uint32_t region_waiters[MAX_REGIONS];           // Trains waiting in the region
+
+    TrainWait waits[MAX_TRAINS];
+
+    // Claim revisions that were unsafe when asked for, retried as the clock advances
+    uint32_t deferred_claims;                       // Trains with a deferred revision
+    int deferred_max[MAX_TRAINS][MAX_TRACKS];
+
+    // Upcoming route of each train, read by the lookahead predictor
+    RouteStep route[MAX_TRAINS][MAX_ROUTE_STEPS];
+    int route_len[MAX_TRAINS];
 } RailwayState;
 
+// Train and track names, kept out of RailwayState so the hot numeric state stays
+// compact. Each distinct string is stored once in the pool; intern_slot finds a
+// string's pool offset and train_slot maps that offset to a train id, both by hash.
+// Strings nobody names any more (renamed or readmitted trains) stay until the
+// pool or the hash table fills up, then the table is rebuilt from the live names.
+typedef struct {
+    char pool[NAME_POOL_BYTES];
+    int used;
+    int interned;                       // Occupied intern slots
+    int intern_slot[NAME_HASH_SLOTS];   // Pool offset, -1 = empty
+    int train_name[MAX_TRAINS];         // Pool offset of each train's name
+    int track_name[MAX_TRACKS];
+    int train_slot[NAME_HASH_SLOTS];    // Train id, -1 = empty
+    int ntrains, ntracks;
+} NameTable;
+
+// The live names alone, packed; what a checkpoint keeps of the NameTable
+typedef struct {
+    char pool[(MAX_TRAINS + MAX_TRACKS) * MAX_NAME_LEN];
+    int train_name[MAX_TRAINS];
+    int track_name[MAX_TRACKS];
+    int ntrains, ntracks;
+} NameSnapshot;
+
+// The canonical part of a RailwayState: what a checkpoint keeps. Need, the track
+// aggregates, compact copies, kernels, components, margins and region caches all
+// follow from it and are rebuilt on restore.
+typedef struct {
+    int ntrains, ntracks;
+    uint32_t active;                        // One bit per live train
+    int available[MAX_TRACKS];
+    int maximum[MAX_TRAINS][MAX_TRACKS];
+    int allocation[MAX_TRAINS][MAX_TRACKS];
+    uint64_t track_links[MAX_TRACKS];
+    TrainWait waits[MAX_TRAINS];
+    uint32_t deferred_claims;
+    int deferred_max[MAX_TRAINS][MAX_TRACKS];
+    RouteStep route[MAX_TRAINS][MAX_ROUTE_STEPS];
+    int route_len[MAX_TRAINS];
+} StateSnapshot;
+
 // Structure for saving/restoring the system state (Checkpoints)
 typedef struct {
-    RailwayState state;
+    StateSnapshot state;
+    NameSnapshot names;                 // Cold copy, only touched on save/restore
     int valid;
     char note[128];
 } CP;
@@ -44,16 +223,75 @@ typedef struct {
     int adj[MAX_TRAINS][MAX_TRAINS]; // Adjacency matrix: adj[i][j] = 1 if Train i waits for Train j
 } WFG;
 
-static RailwayState rail;
-static CP checkpoints[MAX_CHECKPOINTS];
+// Row kernels selected per scenario (cell width x row length class), see select_kernels
+typedef struct KernelSet {
+    int (*safety)(const RailwayState *s, const int trains[], int nt, int safe_seq[]);
+    void (*wfg)(const RailwayState *s, WFG *g);
+    int (*row_le)(int m, const int request[], const int available[]);
+    const char *name;
+} KernelSet;
+
+// Bump allocator. Allocations are never freed one by one: a whole arena (or
+// everything after a mark) is released in O(1) by moving the offset back.
+typedef struct {
+    unsigned char *base;    // Reserved on first use
+    size_t size;
+    size_t used;
+} Arena;
+
+// A denied request waiting for its deadline. Links are pool indexes so a node
+// is 16 bytes; the requested units live in a parallel array.
+typedef struct {
+    uint32_t next;              // Wheel slot list, or free list
+    uint32_t expires;           // Absolute tick
+    short tid;
+    unsigned char boosts;       // Timeouts so far; the next wait is WHEEL_SLOTS >> boosts ticks
+    uint32_t gen;               // train_gen of tid when queued; 32 bits so it never wraps in practice
+} PendingRequest;
+
+#define NIL_PENDING UINT32_MAX
+
+typedef struct {
+    uint32_t now;                                   // Current tick
+    uint32_t head[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS];                // Bit k set while head[level][k] holds requests
+    PendingRequest *pool;                           // Scenario arena, made on first use
+    uint16_t *units;                                // ntracks per pool entry
+    uint32_t free_head, used, count;
+    uint32_t needs_recovery;                        // Trains whose requests exhausted their boosts
+} TimerWheel;
+
+// A train is starving once its denial streak or the ticks since the streak began
+// reach these limits
+typedef struct {
+    int streak;
+    uint32_t wait;
+} StarvationLimits;
+
+struct AdmissionRing;
+struct EventLog;
+
+// One simulator instance: the library's opaque railway_t. Nothing is shared
+// between instances, so each can be driven from its own thread.
+struct railway {
+    RailwayState state;
+    NameTable names;
+    CP checkpoints[MAX_CHECKPOINTS];
+    Arena scenario_arena;               // Reset on every load and checkpoint restore
+    Arena scratch_arena;                // Released after each pass
+    Arena explore_arena;                // Released after each model check or prediction
+    TimerWheel wheel;
+    StarvationLimits starve_limits;
+    struct AdmissionRing *admission;    // Running between railway_admission_start and _stop
+    struct EventLog *log;               // Open between railway_log_open and railway_log_close
+};
 
 // --- Utility Functions ---
 
-// Fatal error handler
-static void die(const char *s) {
-    fprintf(stderr, "Fatal: %s\n", s);
-    exit(EXIT_FAILURE);
-}
+// Region fragments keep their wait edges as one bit per train
+#if MAX_TRAINS > 32
+#error "region WFG fragments store train sets in 32-bit masks"
+#endif
 
 // Safer string copy
 static void safe_strcpy(char *dst, const char *src, size_t n) {
@@ -61,175 +299,1145 @@ static void safe_strcpy(char *dst, const char *src, size_t n) {
     dst[n-1] = '\0';
 }
 
+// --- Arena Allocation ---
+
+// NULL if the arena cannot be allocated or has no room left
+static void *arena_alloc(Arena *a, size_t bytes) {
+    if (!a->base && !(a->base = malloc(a->size))) return NULL;
+    size_t start = (a->used + 15) & ~(size_t)15; // 16-byte alignment for any type
+    if (start + bytes > a->size) return NULL;
+    a->used = start + bytes;
+    return a->base + start;
+}
+
+static void *arena_zalloc(Arena *a, size_t bytes) {
+    void *p = arena_alloc(a, bytes);
+    if (p) memset(p, 0, bytes);
+    return p;
+}
+
+static size_t arena_mark(const Arena *a) { return a->used; }
+static void arena_release(Arena *a, size_t mark) { a->used = mark; }
+
+// --- Event Log ---
+
+// Monotonic clock in nanoseconds
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Decisions of a handle are logged as fixed-size binary records into a ring of
+// that handle; a background drainer formats them (or writes them raw), so the
+// hot path never touches stdio.
+enum {
+    LOG_GRANT,          // a = tracks the train still needs
+    LOG_DENY,           // a = denial streak
+    LOG_RELEASE,        // Preemption or voluntary release
+    LOG_TERMINATE,
+    LOG_ADMIT,
+    LOG_RETIRE,
+    LOG_REVISE,         // a = revise_claim result
+    LOG_CAPACITY,       // a = track, b = new capacity
+    LOG_ESCALATE,       // Request timed out after every boost
+    LOG_EVENTS
+};
+
+static const char *const log_event_names[LOG_EVENTS] = {
+    "GRANT", "DENY", "RELEASE", "TERMINATE", "ADMIT", "RETIRE", "REVISE", "CAPACITY", "ESCALATE"
+};
+
+typedef struct {
+    long long ts;
+    int16_t event;
+    int16_t train;
+    int32_t a, b;
+} LogRecord;
+
+// Single-producer single-consumer: whichever thread is calling into the handle
+// appends (calls on a handle never overlap), the drainer pops
+typedef struct EventLog {
+    _Alignas(64) _Atomic uint32_t tail;     // Written by the calling thread
+    _Alignas(64) _Atomic uint32_t head;     // Written by the drainer
+    _Atomic int stop;
+    int raw;                                // Dump records as they are instead of text
+    FILE *out;
+    long written;                           // Drainer only until it is joined
+    long dropped;                           // Records lost to a full ring
+    pthread_t drainer;
+    LogRecord rec[LOG_RING_RECORDS];
+} EventLog;
+
+// Appends one record; a full ring drops it
+static void log_event(EventLog *l, int event, int train, int a, int b) {
+    uint32_t tail = atomic_load_explicit(&l->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&l->head, memory_order_acquire) == LOG_RING_RECORDS) { ++l->dropped; return; }
+    l->rec[tail & (LOG_RING_RECORDS - 1)] = (LogRecord){ now_ns(), (int16_t)event, (int16_t)train, a, b };
+    atomic_store_explicit(&l->tail, tail + 1, memory_order_release);
+}
+
+// Costs one pointer test while the handle's log is closed
+#define LOG_EVENT(s, event, train, a, b) \
+    do { EventLog *log_ = (s)->ctx->log; if (log_) log_event(log_, event, train, a, b); } while (0)
+
+// Moves everything buffered so far to the output; returns the records written
+static long log_drain_once(EventLog *l) {
+    long n = 0;
+    uint32_t head = atomic_load_explicit(&l->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&l->tail, memory_order_acquire);
+    for (; head != tail; ++head, ++n) {
+        const LogRecord *e = &l->rec[head & (LOG_RING_RECORDS - 1)];
+        if (l->raw) fwrite(e, sizeof(*e), 1, l->out);
+        else fprintf(l->out, "%lld.%09lld %-9s train=%d %d %d\n", e->ts / 1000000000LL, e->ts % 1000000000LL,
+                     e->event >= 0 && e->event < LOG_EVENTS ? log_event_names[e->event] : "?", e->train, e->a, e->b);
+    }
+    atomic_store_explicit(&l->head, head, memory_order_release);
+    return n;
+}
+
+static void *log_drainer_main(void *arg) {
+    EventLog *l = arg;
+    struct timespec nap = { 0, 1000000 };
+    while (!atomic_load(&l->stop)) {
+        long n = log_drain_once(l);
+        l->written += n;
+        if (!n) nanosleep(&nap, NULL);
+    }
+    l->written += log_drain_once(l);
+    return NULL;
+}
+
+// --- Interned Names ---
+
+// FNV-1a string hash
+static unsigned name_hash(const char *str) {
+    unsigned h = 2166136261u;
+    for (; *str; ++str) h = (h ^ (unsigned char)*str) * 16777619u;
+    return h;
+}
+
+static void index_train_names(NameTable *t);
+
+// Copies the names in use into p, each once per holder
+static void pack_names(const NameTable *t, NameSnapshot *p) {
+    int used = 0;
+    p->ntrains = t->ntrains;
+    p->ntracks = t->ntracks;
+    for (int k = 0; k < t->ntrains + t->ntracks; ++k) {
+        int off = k < t->ntrains ? t->train_name[k] : t->track_name[k - t->ntrains];
+        size_t len = strlen(t->pool + off) + 1;
+        memcpy(p->pool + used, t->pool + off, len);
+        if (k < t->ntrains) p->train_name[k] = used;
+        else p->track_name[k - t->ntrains] = used;
+        used += (int)len;
+    }
+}
+
+static int intern_name(NameTable *t, const char *str, int insert);
+
+// Rebuilds t from p. Cannot fail: p holds at most MAX_TRAINS + MAX_TRACKS names.
+static void unpack_names(NameTable *t, const NameSnapshot *p) {
+    t->used = t->interned = 0;
+    t->ntrains = t->ntracks = 0; // Nothing for intern_name to compact meanwhile
+    for (int h = 0; h < NAME_HASH_SLOTS; ++h) t->intern_slot[h] = -1;
+    for (int i = 0; i < p->ntrains; ++i) t->train_name[i] = intern_name(t, p->pool + p->train_name[i], 1);
+    for (int j = 0; j < p->ntracks; ++j) t->track_name[j] = intern_name(t, p->pool + p->track_name[j], 1);
+    t->ntrains = p->ntrains;
+    t->ntracks = p->ntracks;
+    index_train_names(t);
+}
+
+// Returns the pool offset of str, storing it first if insert is set. -1 if
+// absent, or if it does not fit even once the unused names are dropped.
+static int intern_name(NameTable *t, const char *str, int insert) {
+    char buf[MAX_NAME_LEN];
+    safe_strcpy(buf, str, sizeof(buf));
+    size_t len = strlen(buf) + 1;
+    unsigned h = name_hash(buf) & (NAME_HASH_SLOTS - 1);
+    for (int probes = 0; probes < NAME_HASH_SLOTS; ++probes, h = (h + 1) & (NAME_HASH_SLOTS - 1)) {
+        int off = t->intern_slot[h];
+        if (off < 0) break;
+        if (strcmp(t->pool + off, buf) == 0) return off;
+    }
+    if (!insert) return -1;
+
+    // Keep a quarter of the slots free so probes stay short
+    if (t->used + len > sizeof(t->pool) || t->interned >= NAME_HASH_SLOTS / 4 * 3) {
+        NameSnapshot live;
+        pack_names(t, &live);
+        unpack_names(t, &live);
+        if (t->used + len > sizeof(t->pool) || t->interned >= NAME_HASH_SLOTS / 4 * 3) return -1;
+        h = name_hash(buf) & (NAME_HASH_SLOTS - 1);
+        while (t->intern_slot[h] >= 0) h = (h + 1) & (NAME_HASH_SLOTS - 1);
+    }
+    memcpy(t->pool + t->used, buf, len);
+    t->intern_slot[h] = t->used;
+    t->used += (int)len;
+    t->interned++;
+    return t->intern_slot[h];
+}
+
+// Rebuilds the name -> train id index (after a load, a rename or an admission)
+static void index_train_names(NameTable *t) {
+    for (int h = 0; h < NAME_HASH_SLOTS; ++h) t->train_slot[h] = -1;
+    for (int i = 0; i < t->ntrains; ++i) {
+        unsigned h = (unsigned)t->train_name[i] * 2654435761u & (NAME_HASH_SLOTS - 1);
+        while (t->train_slot[h] >= 0) {
+            if (t->train_name[t->train_slot[h]] == t->train_name[i]) break; // Keep the first holder
+            h = (h + 1) & (NAME_HASH_SLOTS - 1);
+        }
+        if (t->train_slot[h] < 0) t->train_slot[h] = i;
+    }
+}
+
+static void reset_names(NameTable *t, int ntrains, int ntracks) {
+    NameSnapshot defaults;
+    int used = 0;
+    defaults.ntrains = ntrains;
+    defaults.ntracks = ntracks;
+    for (int i = 0; i < ntrains; ++i) {
+        defaults.train_name[i] = used;
+        used += snprintf(defaults.pool + used, MAX_NAME_LEN, "Train%d", i) + 1;
+    }
+    for (int j = 0; j < ntracks; ++j) {
+        defaults.track_name[j] = used;
+        used += snprintf(defaults.pool + used, MAX_NAME_LEN, "Track%d", j) + 1;
+    }
+    unpack_names(t, &defaults);
+}
+
+static const char *train_name(const RailwayState *s, int tid) {
+    const NameTable *names = &s->ctx->names;
+    return names->pool + names->train_name[tid];
+}
+
+static const char *track_name(const RailwayState *s, int j) {
+    const NameTable *names = &s->ctx->names;
+    return names->pool + names->track_name[j];
+}
+
+// Both return 0, or -1 (keeping the old name) if the name table is full
+static int set_train_name(RailwayState *s, int tid, const char *str) {
+    NameTable *names = &s->ctx->names;
+    int off = intern_name(names, str, 1);
+    if (off < 0) return -1;
+    names->train_name[tid] = off;
+    index_train_names(names);
+    return 0;
+}
+
+static int set_track_name(RailwayState *s, int j, const char *str) {
+    NameTable *names = &s->ctx->names;
+    int off = intern_name(names, str, 1);
+    if (off < 0) return -1;
+    names->track_name[j] = off;
+    return 0;
+}
+
+// Name -> train id in O(1), -1 if no train has that name
+static int find_train(const RailwayState *s, const char *str) {
+    NameTable *names = &s->ctx->names;
+    int off = intern_name(names, str, 0);
+    if (off < 0) return -1;
+    unsigned h = (unsigned)off * 2654435761u & (NAME_HASH_SLOTS - 1);
+    for (; names->train_slot[h] >= 0; h = (h + 1) & (NAME_HASH_SLOTS - 1))
+        if (names->train_name[names->train_slot[h]] == off) return names->train_slot[h];
+    return -1;
+}
+
+// Recounts the tracks on which train tid still has outstanding Need
+static void refresh_need_count(RailwayState *s, int tid) {
+    int cnt = 0;
+    for (int j = 0; j < s->ntracks; ++j) if (s->need[tid][j] > 0) ++cnt;
+    s->need_cnt[tid] = cnt;
+}
+
+static void select_kernels(RailwayState *s);
+
+// --- Compact Cell Storage ---
+
+static void store_compact_row(RailwayState *s, int tid) {
+    for (int j = 0; j < s->ntracks; ++j) {
+        if (s->cell_width == 1) {
+            s->cneed.w8[tid][j] = (uint8_t)s->need[tid][j];
+            s->calloc.w8[tid][j] = (uint8_t)s->allocation[tid][j];
+        } else if (s->cell_width == 2) {
+            s->cneed.w16[tid][j] = (uint16_t)s->need[tid][j];
+            s->calloc.w16[tid][j] = (uint16_t)s->allocation[tid][j];
+        }
+    }
+}
+
+// Picks the narrowest cell width for the scenario and rebuilds the compact copies.
+// Maximum bounds both Need and Allocation, so it decides the width on its own.
+static void select_cell_width(RailwayState *s) {
+    int maxv = 0, neg = 0;
+    for (int i = 0; i < s->ntrains; ++i)
+        for (int j = 0; j < s->ntracks; ++j) {
+            int v = s->maximum[i][j] > s->allocation[i][j] ? s->maximum[i][j] : s->allocation[i][j];
+            if (v > maxv) maxv = v;
+            if (s->need[i][j] < 0 || s->allocation[i][j] < 0) neg = 1;
+        }
+    if (neg || maxv > UINT16_MAX) s->cell_width = 4;
+    else if (maxv > UINT8_MAX) s->cell_width = 2;
+    else s->cell_width = 1;
+    // The unions are reinterpreted at the new width, so clear the padding first
+    memset(&s->cneed, 0, sizeof(s->cneed));
+    memset(&s->calloc, 0, sizeof(s->calloc));
+    for (int i = 0; i < s->ntrains; ++i) store_compact_row(s, i);
+    select_kernels(s);
+}
+
+// Re-syncs one compact cell after a mutation. A value that no longer fits the
+// current width (overflow) widens the storage for the whole scenario.
+static void store_compact_cell(RailwayState *s, int tid, int j) {
+    if (s->cell_width == 4) return;
+    int limit = (s->cell_width == 1) ? UINT8_MAX : UINT16_MAX;
+    int nd = s->need[tid][j], al = s->allocation[tid][j];
+    if (nd < 0 || al < 0 || nd > limit || al > limit) { select_cell_width(s); return; }
+    if (s->cell_width == 1) {
+        s->cneed.w8[tid][j] = (uint8_t)nd;
+        s->calloc.w8[tid][j] = (uint8_t)al;
+    } else {
+        s->cneed.w16[tid][j] = (uint16_t)nd;
+        s->calloc.w16[tid][j] = (uint16_t)al;
+    }
+}
+
+// Moves delta units of track j from the available pool to train tid (a negative
+// delta hands them back). Need is maintained incrementally: only the touched cell
+// and the train's count of outstanding tracks change, never the whole matrix.
+static void set_cell(RailwayState *s, int tid, int j, int alloc, int max);
+
+static void move_units(RailwayState *s, int tid, int j, int delta) {
+    set_cell(s, tid, j, s->allocation[tid][j] + delta, s->maximum[tid][j]);
+}
+
+// Signature weights of a cell's Need and Allocation, by row or column index
+#define SIG_NEED(k)  (2654435761u * (unsigned)(k) + 1u)
+#define SIG_ALLOC(k) (40503u * (unsigned)(k) + 0x9e37u)
+
+// Sets one cell's Allocation and Maximum. Units taken or returned come from the
+// available pool, and Need, the train's outstanding-track count, the track
+// aggregates and the compact copy are updated for this cell alone.
+static void set_cell(RailwayState *s, int tid, int j, int alloc, int max) {
+    int old_alloc = s->allocation[tid][j];
+    int old_need = s->need[tid][j];
+    int need = max - alloc;
+
+    s->available[j] -= alloc - old_alloc;
+    s->allocation[tid][j] = alloc;
+    s->maximum[tid][j] = max;
+    s->need[tid][j] = need;
+
+    s->need_cnt[tid] += (need > 0) - (old_need > 0);
+    s->track_alloc[j] += alloc - old_alloc;
+    s->track_holders[j] += (alloc > 0) - (old_alloc > 0);
+    s->track_need[j] += (need > 0 ? need : 0) - (old_need > 0 ? old_need : 0);
+    s->track_waiters[j] += (need > 0) - (old_need > 0);
+    s->row_sig[tid] += (unsigned)(need - old_need) * SIG_NEED(j) + (unsigned)(alloc - old_alloc) * SIG_ALLOC(j);
+    s->col_sig[j] += (unsigned)(need - old_need) * SIG_NEED(tid) + (unsigned)(alloc - old_alloc) * SIG_ALLOC(tid);
+    s->region_stale[s->track_region[j]] = 1;
+    store_compact_cell(s, tid, j);
+}
+
+// Rebuilds the per-track aggregates from the matrices (after a scenario load)
+static void compute_track_aggregates(RailwayState *s) {
+    for (int i = 0; i < s->ntrains; ++i) s->row_sig[i] = 0;
+    for (int j = 0; j < s->ntracks; ++j) {
+        s->track_alloc[j] = s->track_holders[j] = s->track_need[j] = s->track_waiters[j] = 0;
+        s->col_sig[j] = 0;
+        for (int a = 0; a < s->nactive; ++a) {
+            int i = s->active[a];
+            int al = s->allocation[i][j], nd = s->need[i][j];
+            s->track_alloc[j] += al;
+            s->track_holders[j] += (al > 0);
+            if (nd > 0) { s->track_need[j] += nd; ++s->track_waiters[j]; }
+            s->row_sig[i] += (unsigned)nd * SIG_NEED(j) + (unsigned)al * SIG_ALLOC(j);
+            s->col_sig[j] += (unsigned)nd * SIG_NEED(i) + (unsigned)al * SIG_ALLOC(i);
+        }
+    }
+}
+
+static int track_capacity(const RailwayState *s, int j) {
+    return s->available[j] + s->track_alloc[j];
+}
+
+// O(m) sufficient condition for safety: if every track can cover the summed Need of
+// all its waiters at once, every train can finish in any order.
+static int all_needs_fit(const RailwayState *s) {
+    for (int j = 0; j < s->ntracks; ++j) if (s->track_need[j] > s->available[j]) return 0;
+    return 1;
+}
+
+// O(m) test for whether the WFG can have any edge: some exhausted track must have
+// both a holder and a waiter.
+static int wfg_may_have_edges(const RailwayState *s) {
+    for (int j = 0; j < s->ntracks; ++j)
+        if (s->available[j] <= 0 && s->track_holders[j] && s->track_waiters[j]) return 1;
+    return 0;
+}
+
 // Recalculates the Need matrix: Need = Maximum - Allocation
 static void compute_need(RailwayState *s) {
-    for (int i = 0; i < s->ntrains; ++i)
+    for (int i = 0; i < s->ntrains; ++i) {
         for (int j = 0; j < s->ntracks; ++j)
             s->need[i][j] = s->maximum[i][j] - s->allocation[i][j];
+        refresh_need_count(s, i);
+    }
+    memset(s->region_stale, 1, sizeof(s->region_stale));
+    compute_track_aggregates(s);
+    select_cell_width(s);
+}
+
+static int train_is_active(const RailwayState *s, int tid) {
+    return tid >= 0 && tid < s->ntrains && s->active_pos[tid] >= 0;
+}
+
+// Removes a train from the active list (keeping it sorted) and frees its slot
+static void deactivate_train(RailwayState *s, int tid) {
+    int pos = s->active_pos[tid];
+    for (int a = pos; a + 1 < s->nactive; ++a) {
+        s->active[a] = s->active[a + 1];
+        s->active_pos[s->active[a]] = a;
+    }
+    --s->nactive;
+    s->active_pos[tid] = -1;
+    s->free_slots[s->nfree++] = tid;
+}
+
+// Connects tracks a and b in both directions
+static void link_tracks(RailwayState *s, int a, int b) {
+    s->track_links[a] |= 1ull << b;
+    s->track_links[b] |= 1ull << a;
 }
 
 // Initializes the state with empty/zero values
-static void init_empty(RailwayState *s, int ntrains, int ntracks) {
-    if (ntrains < 1 || ntrains > MAX_TRAINS || ntracks < 1 || ntracks > MAX_TRACKS) die("invalid sizes");
+// Returns 0, or -1 (state untouched) for sizes beyond the limits
+static int init_empty(RailwayState *s, int ntrains, int ntracks) {
+    if (ntrains < 1 || ntrains > MAX_TRAINS || ntracks < 1 || ntracks > MAX_TRACKS) return -1;
     s->ntrains = ntrains;
     s->ntracks = ntracks;
-    for (int i = 0; i < ntrains; ++i) snprintf(s->tname[i], MAX_NAME_LEN, "Train%d", i);
-    for (int j = 0; j < ntracks; ++j) snprintf(s->rname[j], MAX_NAME_LEN, "Track%d", j);
-    for (int j = 0; j < ntracks; ++j) s->available[j] = 0;
-    for (int i = 0; i < ntrains; ++i)
-        for (int j = 0; j < ntracks; ++j) s->maximum[i][j] = s->allocation[i][j] = s->need[i][j] = 0;
+    reset_names(&s->ctx->names, ntrains, ntracks);
+    arena_release(&s->ctx->scenario_arena, 0); // Drops all per-scenario working memory at once
+    memset(&s->ctx->wheel, 0, sizeof(s->ctx->wheel));  // Its pool lived in the scenario arena
+    memset(s->available, 0, sizeof(s->available));
+    memset(s->maximum, 0, sizeof(s->maximum));
+    memset(s->allocation, 0, sizeof(s->allocation));
+    memset(s->need, 0, sizeof(s->need));
+    memset(&s->cneed, 0, sizeof(s->cneed));
+    memset(&s->calloc, 0, sizeof(s->calloc));
+    memset(s->track_alloc, 0, sizeof(s->track_alloc));
+    memset(s->track_holders, 0, sizeof(s->track_holders));
+    memset(s->track_need, 0, sizeof(s->track_need));
+    memset(s->track_waiters, 0, sizeof(s->track_waiters));
+    memset(s->track_links, 0, sizeof(s->track_links));
+    for (int j = 0; j + 1 < ntracks; ++j) link_tracks(s, j, j + 1); // A line until loaders add more
+    memset(s->waits, 0, sizeof(s->waits));
+    memset(s->train_gen, 0, sizeof(s->train_gen));
+    s->deferred_claims = 0;
+    for (int i = 0; i < ntrains; ++i) {
+        s->need_cnt[i] = 0;
+        s->active[i] = i;
+        s->active_pos[i] = i;
+    }
+    s->nactive = ntrains;
+    s->nfree = 0;
+    s->cell_width = 4;
+    select_kernels(s);
+    s->ncomp = 0;
+    s->nregions = (ntracks + REGION_TRACKS - 1) / REGION_TRACKS;
+    for (int j = 0; j < ntracks; ++j) s->track_region[j] = j / REGION_TRACKS;
+    memset(s->region_stale, 1, sizeof(s->region_stale));
+    return 0;
+}
+
+static void pack_state(const RailwayState *s, StateSnapshot *p) {
+    p->ntrains = s->ntrains;
+    p->ntracks = s->ntracks;
+    p->active = 0;
+    for (int a = 0; a < s->nactive; ++a) p->active |= 1u << s->active[a];
+    memcpy(p->available, s->available, sizeof(p->available));
+    memcpy(p->maximum, s->maximum, sizeof(p->maximum));
+    memcpy(p->allocation, s->allocation, sizeof(p->allocation));
+    memcpy(p->track_links, s->track_links, sizeof(p->track_links));
+    memcpy(p->waits, s->waits, sizeof(p->waits));
+    p->deferred_claims = s->deferred_claims;
+    memcpy(p->deferred_max, s->deferred_max, sizeof(p->deferred_max));
+    memcpy(p->route, s->route, sizeof(p->route));
+    memcpy(p->route_len, s->route_len, sizeof(p->route_len));
+}
+
+// Rebuilds s from p. Slot generations are kept: they only ever grow.
+static void unpack_state(RailwayState *s, const StateSnapshot *p) {
+    s->ntrains = p->ntrains;
+    s->ntracks = p->ntracks;
+    memcpy(s->available, p->available, sizeof(s->available));
+    memcpy(s->maximum, p->maximum, sizeof(s->maximum));
+    memcpy(s->allocation, p->allocation, sizeof(s->allocation));
+    memcpy(s->track_links, p->track_links, sizeof(s->track_links));
+    memcpy(s->waits, p->waits, sizeof(s->waits));
+    s->deferred_claims = p->deferred_claims;
+    memcpy(s->deferred_max, p->deferred_max, sizeof(s->deferred_max));
+    memcpy(s->route, p->route, sizeof(s->route));
+    memcpy(s->route_len, p->route_len, sizeof(s->route_len));
+
+    s->nactive = s->nfree = 0;
+    for (int i = 0; i < s->ntrains; ++i) {
+        if (p->active >> i & 1u) {
+            s->active_pos[i] = s->nactive;
+            s->active[s->nactive++] = i;
+        } else s->active_pos[i] = -1;
+    }
+    for (int i = s->ntrains - 1; i >= 0; --i) // Lowest free id is reused first
+        if (s->active_pos[i] < 0) s->free_slots[s->nfree++] = i;
+
+    s->nregions = (s->ntracks + REGION_TRACKS - 1) / REGION_TRACKS;
+    for (int j = 0; j < s->ntracks; ++j) s->track_region[j] = j / REGION_TRACKS;
+    s->ncomp = 0;
+    memset(s->need, 0, sizeof(s->need)); // Rows past ntrains too: set_cell adds to them on admission
+    compute_need(s); // Need, aggregates, compact copies and kernels; marks every region stale
 }
 
 // Saves the current state as a checkpoint
 static int save_checkpoint(const RailwayState *s, const char *note) {
     for (int i = 0; i < MAX_CHECKPOINTS; ++i) {
-        if (!checkpoints[i].valid) {
-            checkpoints[i].state = *s;
-            checkpoints[i].valid = 1;
-            if (note && note[0]) safe_strcpy(checkpoints[i].note, note, sizeof(checkpoints[i].note));
-            else safe_strcpy(checkpoints[i].note, "checkpoint", sizeof(checkpoints[i].note));
+        CP *cp = &s->ctx->checkpoints[i];
+        if (!cp->valid) {
+            pack_state(s, &cp->state);
+            pack_names(&s->ctx->names, &cp->names);
+            cp->valid = 1;
+            if (note && note[0]) safe_strcpy(cp->note, note, sizeof(cp->note));
+            else safe_strcpy(cp->note, "checkpoint", sizeof(cp->note));
             return i;
         }
     }
     return -1;
 }
 
-// Restores a previously saved checkpoint
+// Drops every queued request, freeing the pool with the rest of the scenario
+// arena (its unit records are sized for the track count at the time). The
+// clock keeps its tick.
+static void clear_wheel(struct railway *ctx) {
+    uint32_t now = ctx->wheel.now;
+    arena_release(&ctx->scenario_arena, 0);
+    memset(&ctx->wheel, 0, sizeof(ctx->wheel));
+    ctx->wheel.now = now;
+}
+
+// Restores a previously saved checkpoint. Queued requests were made against
+// the state being replaced, so they are dropped along with recovery flags.
 static int restore_checkpoint(RailwayState *s, int idx) {
     if (idx < 0 || idx >= MAX_CHECKPOINTS) return -1;
-    if (!checkpoints[idx].valid) return -1;
-    *s = checkpoints[idx].state;
-    checkpoints[idx].valid = 0;
+    if (!s->ctx->checkpoints[idx].valid) return -1;
+    clear_wheel(s->ctx);
+    unpack_state(s, &s->ctx->checkpoints[idx].state);
+    unpack_names(&s->ctx->names, &s->ctx->checkpoints[idx].names);
+    s->ctx->checkpoints[idx].valid = 0;
     return 0;
 }
 
+// --- Connected Components (train-track claim graph) ---
+
+static int uf_find(int parent[], int x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]]; // Path halving
+        x = parent[x];
+    }
+    return x;
+}
+
+// Groups trains and tracks into components with union-find: train i and track j are
+// joined when i claims or holds j. Allocation never exceeds Maximum, so requests and
+// releases cannot merge components; only loading a new claim matrix rebuilds them.
+static void build_components(RailwayState *s) {
+    int n = s->ntrains;
+    int m = s->ntracks;
+    int parent[MAX_COMPONENTS];
+    int label[MAX_COMPONENTS];
+
+    for (int x = 0; x < n + m; ++x) { parent[x] = x; label[x] = -1; }
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < m; ++j)
+            if (s->maximum[i][j] > 0 || s->allocation[i][j] > 0) {
+                int a = uf_find(parent, i), b = uf_find(parent, n + j);
+                if (a != b) parent[a] = b;
+            }
+
+    s->ncomp = 0;
+    for (int x = 0; x < n + m; ++x) {
+        int root = uf_find(parent, x);
+        if (label[root] < 0) label[root] = s->ncomp++;
+        if (x < n) s->train_comp[x] = label[root];
+        else s->track_comp[x - n] = label[root];
+    }
+    for (int c = 0; c < s->ncomp; ++c) s->comp_stale[c] = COMP_STALE_ALL;
+}
+
+// Invalidates the cached verdicts of the component a train released units in.
+// A release never makes a safe component unsafe and the old safe sequence stays
+// valid, so its headroom remains a correct lower bound; only an unsafe component
+// (which may have become safe) needs its margin recomputed.
+static void mark_train_dirty(RailwayState *s, int tid) {
+    if (!s->ncomp) return;
+    int c = s->train_comp[tid];
+    s->comp_stale[c] |= COMP_STALE_SAFETY | COMP_STALE_WFG;
+    if (!s->comp_safe[c]) s->comp_stale[c] |= COMP_STALE_MARGIN;
+}
+
 // Checks if a request is less than or equal to the available resources
 static int request_le_available(int m, const int request[], const int available[]) {
     for (int j = 0; j < m; ++j) if (request[j] > available[j]) return 0;
     return 1;
 }
 
+// request_le_available for a fixed, zero-padded row length M (m is ignored)
+#define DEFINE_ROW_LE(NAME, M)                                                              \
+static int NAME(int m, const int request[], const int available[]) {                        \
+    int over = 0;                                                                           \
+    (void)m;                                                                                \
+    UNROLL_ROW for (int j = 0; j < (M); ++j) over |= (request[j] > available[j]);           \
+    return !over;                                                                           \
+}
+
+DEFINE_ROW_LE(row_le_m4, 4)
+DEFINE_ROW_LE(row_le_m8, 8)
+DEFINE_ROW_LE(row_le_m16, 16)
+DEFINE_ROW_LE(row_le_m32, 32)
+DEFINE_ROW_LE(row_le_m64, 64)
+
 // --- Banker's Algorithm Implementation (Deadlock Avoidance) ---
 
-// Checks if the current state is safe (finds a safe sequence)
+// Need cell accessors for the safety kernels: the stored matrix, or Maximum minus
+// Allocation fused into the comparison so the Need matrix is never read
+#define NEED_STORED(i, j) need[i][j]
+#define NEED_FUSED(i, j) (s->maximum[i][j] - alloc[i][j])
+
+// Banker's safety kernel over a list of trains, instantiated per cell width and per
+// row length M: either s->ntracks (generic) or a constant 4..64 whose row loops are
+// fully unrolled, relying on rows being zero-padded up to M. Tracks outside the
+// trains' component carry zero Need and Allocation for them, so running full rows
+// gives the same verdict as a gathered subset of tracks.
+#define DEFINE_SAFETY_KERNEL(NAME, CELL, NEED, ALLOC, M, NEED_AT)                           \
+static int NAME(const RailwayState *s, const int trains[], int nt, int safe_seq[]) {        \
+    const CELL (*need)[MAX_TRACKS] = NEED;                                                  \
+    const CELL (*alloc)[MAX_TRACKS] = ALLOC;                                                \
+    const int m = (M);                                                                      \
+    int work[MAX_TRACKS];                                                                   \
+    (void)need;                                                                             \
+    int pending[MAX_TRAINS]; /* Unfinished trains, compacted after every sweep */           \
+    int npending = 0;                                                                       \
+                                                                                            \
+    UNROLL_ROW for (int j = 0; j < m; ++j) work[j] = s->available[j];                       \
+                                                                                            \
+    int count = 0;                                                                          \
+    for (int a = 0; a < nt; ++a) {                                                          \
+        int i = trains[a];                                                                  \
+        if (s->need_cnt[i]) { pending[npending++] = i; continue; }                          \
+        /* Trains with no outstanding Need finish immediately */                            \
+        UNROLL_ROW for (int j = 0; j < m; ++j) work[j] += alloc[i][j];                      \
+        if (safe_seq) safe_seq[count] = i;                                                  \
+        ++count;                                                                            \
+    }                                                                                       \
+                                                                                            \
+    while (npending > 0) {                                                                  \
+        int kept = 0;                                                                       \
+        for (int a = 0; a < npending; ++a) {                                                \
+            int i = pending[a];                                                             \
+            int over = 0;                                                                   \
+            /* Check if Need[i] <= Work (branch-free so fixed rows vectorize) */            \
+            UNROLL_ROW for (int j = 0; j < m; ++j) over |= (NEED_AT(i, j) > work[j]);       \
+                                                                                            \
+            if (!over) {                                                                    \
+                /* Simulate completion: Work = Work + Allocation[i] */                      \
+                UNROLL_ROW for (int j = 0; j < m; ++j) work[j] += alloc[i][j];              \
+                if (safe_seq) safe_seq[count] = i; /* Record in safe sequence */            \
+                ++count;                                                                    \
+            } else {                                                                        \
+                pending[kept++] = i;                                                        \
+            }                                                                               \
+        }                                                                                   \
+        if (kept == npending) break; /* No train can proceed */                             \
+        npending = kept;                                                                    \
+    }                                                                                       \
+    return (count == nt); /* True if all trains finished */                                 \
+}
+
+static int safety_kernel(const RailwayState *s, const int trains[], int nt, int safe_seq[]);
+
+// Checks if the current state is safe (finds a safe sequence over the active trains)
 static int safety_check(const RailwayState *s, int safe_seq[]) {
-    int n = s->ntrains;
+    return safety_kernel(s, s->active, s->nactive, safe_seq);
+}
+
+// Round-synchronous variant of safety_check. The order in which satisfiable trains
+// finish does not change the verdict, so every train whose Need fits in the current
+// Work is retired in the same round. Each round is two data-parallel phases (ready
+// test, then a column reduction of their allocations), so the number of sequential
+// steps is the dependency depth of the state rather than n. Both phases are
+// branch-free over rows: the ready test is the scenario's fixed-width row_le
+// kernel, run over zero-padded rows against the round's Work snapshot, and the
+// reduction masks allocations instead of testing them. They run on one thread:
+// at most MAX_TRAINS x MAX_TRACKS = 2048 cells, a round is far cheaper than
+// forking and joining a thread team for it.
+static int safety_check_rounds(const RailwayState *s, int safe_seq[], int *rounds) {
+    int n = s->nactive;
     int m = s->ntracks;
-    int work[MAX_TRACKS];
-    int finish[MAX_TRAINS];
+    int (*row_le)(int, const int[], const int[]) = s->kern->row_le;
+    int work[MAX_TRACKS] = {0}; // Padding stays 0, as in the Need rows
+    int pending[MAX_TRAINS];
+    int ready[MAX_TRAINS];
+    int npending = n;
 
     for (int j = 0; j < m; ++j) work[j] = s->available[j];
-    for (int i = 0; i < n; ++i) finish[i] = 0;
-
-    int count = 0;
-    while (count < n) {
-        int found = 0;
-        for (int i = 0; i < n; ++i) {
-            if (!finish[i]) {
-                int ok = 1;
-                // Check if Need[i] <= Work
-                for (int j = 0; j < m; ++j) if (s->need[i][j] > work[j]) { ok = 0; break; }
-                
-                if (ok) {
-                    // Simulate completion: Work = Work + Allocation[i]
-                    for (int j = 0; j < m; ++j) work[j] += s->allocation[i][j];
-                    finish[i] = 1;
-                    if (safe_seq) safe_seq[count] = i; // Record in safe sequence
-                    ++count;
-                    found = 1;
-                }
-            }
+    for (int a = 0; a < n; ++a) pending[a] = s->active[a];
+
+    int count = 0, r = 0;
+    while (npending > 0) {
+        // Phase 1: test every unfinished train against the same Work snapshot
+        for (int a = 0; a < npending; ++a) ready[a] = row_le(m, s->need[pending[a]], work);
+
+        // Phase 2: Work += sum of Allocation over all ready trains
+        for (int j = 0; j < m; ++j) {
+            int add = 0;
+            for (int a = 0; a < npending; ++a) add += s->allocation[pending[a]][j] & -ready[a];
+            work[j] += add;
+        }
+
+        int kept = 0;
+        for (int a = 0; a < npending; ++a) {
+            if (!ready[a]) { pending[kept++] = pending[a]; continue; }
+            if (safe_seq) safe_seq[count] = pending[a];
+            ++count;
         }
-        if (!found) break; // No train can proceed
+        if (kept == npending) break; // No train can proceed
+        npending = kept;
+        ++r;
     }
-    return (count == n); // True if all trains finished
+    if (rounds) *rounds = r;
+    return (count == n);
 }
 
-// Attempts to grant a track request using the Banker's Algorithm
-static int bankers_request(RailwayState *s, int tid, const int request[]) {
-    if (tid < 0 || tid >= s->ntrains) return 0;
-    int m = s->ntracks;
+// --- Equivalence-Class Compression ---
 
-    // 1. Check if Request <= Need[tid]
-    for (int j = 0; j < m; ++j) if (request[j] > s->need[tid][j]) return 0;
+// Banker's input with identical trains merged into one row with a multiplicity
+// and interchangeable tracks pooled into one column. Once one train of a class
+// fits, Work only grows, so the whole class finishes together; tracks whose
+// columns are identical always compare alike. The verdict is unchanged.
+typedef struct {
+    int n, m;                           // Classes and pooled tracks
+    int mult[MAX_TRAINS];
+    int need[MAX_TRAINS][MAX_TRACKS];
+    int alloc[MAX_TRAINS][MAX_TRACKS];  // Per train of the class
+    int work[MAX_TRACKS];               // Available plus what trains needing nothing return
+} CompressedState;
 
-    // 2. Check if Request <= Available
-    if (!request_le_available(m, request, s->available)) return 0;
+#define SIG_SLOTS 128 // Power of two above MAX_TRACKS and MAX_TRAINS
+#define SIG_SLOT(sig) (((sig) * 0x9e3779b1u) >> 25)
 
-    // 3. Tentatively allocate resources (modify state)
-    for (int j = 0; j < m; ++j) {
-        s->available[j] -= request[j];
-        s->allocation[tid][j] += request[j];
-        s->need[tid][j] -= request[j];
-    }
+static int same_train_row(const RailwayState *s, int a, int b) {
+    size_t row = sizeof(int) * (size_t)s->ntracks;
+    return !memcmp(s->need[a], s->need[b], row) && !memcmp(s->allocation[a], s->allocation[b], row);
+}
 
-    // 4. Check if the new state is safe
-    int seq[MAX_TRAINS];
-    int ok = safety_check(s, seq);
+// Trains of a class share their rows, so two tracks compare alike for every
+// train once they match on the class representatives and on the starting Work
+static int same_track_column(const RailwayState *s, const int rep[], int n, const int work[], int j, int k) {
+    if (work[j] != work[k]) return 0;
+    for (int c = 0; c < n; ++c)
+        if (s->need[rep[c]][j] != s->need[rep[c]][k] || s->allocation[rep[c]][j] != s->allocation[rep[c]][k]) return 0;
+    return 1;
+}
 
-    if (!ok) {
-        // State is unsafe: Rollback the allocation
-        for (int j = 0; j < m; ++j) {
-            s->available[j] += request[j];
-            s->allocation[tid][j] -= request[j];
-            s->need[tid][j] += request[j];
+// Groups the trains of component comp (-1 = all trains) into classes of
+// identical rows, then pools tracks that are identical across those classes,
+// matching the maintained signatures first and confirming on a match. Tracks
+// nobody needs are left out (they never block), and so are trains needing
+// nothing: they finish first and their units start out in Work. Returns 0
+// without building the matrices when grouping would shrink them by less than
+// a quarter.
+static int compress_state(const RailwayState *s, const int trains[], int nt, int comp, CompressedState *cs) {
+    int keep[MAX_TRACKS], rep[MAX_TRAINS], work[MAX_TRACKS], nwanted = 0, nneedy = 0;
+    signed char slot[SIG_SLOTS]; // Signature -> class index, -1 = empty
+
+    memset(slot, -1, sizeof(slot));
+    memcpy(work, s->available, sizeof(int) * (size_t)s->ntracks);
+    cs->n = 0;
+    for (int t = 0; t < nt; ++t) {
+        int i = trains[t];
+        if (!s->need_cnt[i]) {
+            for (int j = 0; j < s->ntracks; ++j) work[j] += s->allocation[i][j];
+            continue;
         }
-        return 0;
+        ++nneedy;
+        unsigned h = SIG_SLOT(s->row_sig[i]);
+        while (slot[h] >= 0 && !(s->row_sig[rep[slot[h]]] == s->row_sig[i] && same_train_row(s, rep[slot[h]], i)))
+            h = (h + 1) & (SIG_SLOTS - 1);
+        if (slot[h] >= 0) { ++cs->mult[slot[h]]; continue; }
+        slot[h] = (signed char)cs->n;
+        rep[cs->n] = i;
+        cs->mult[cs->n++] = 1;
     }
-    
-    // Request is safe and granted
+
+    // col_sig covers every train, so tracks it tells apart are merely not pooled
+    memset(slot, -1, sizeof(slot));
+    cs->m = 0;
+    for (int j = 0; j < s->ntracks; ++j) {
+        if (!s->track_waiters[j] || (comp >= 0 && s->track_comp[j] != comp)) continue;
+        ++nwanted;
+        unsigned h = SIG_SLOT(s->col_sig[j]);
+        while (slot[h] >= 0 && !(s->col_sig[keep[slot[h]]] == s->col_sig[j] && same_track_column(s, rep, cs->n, work, keep[slot[h]], j)))
+            h = (h + 1) & (SIG_SLOTS - 1);
+        if (slot[h] < 0) { slot[h] = (signed char)cs->m; keep[cs->m++] = j; }
+    }
+    if (4 * cs->n * cs->m > 3 * nneedy * nwanted) return 0;
+
+    for (int k = 0; k < cs->m; ++k) cs->work[k] = work[keep[k]];
+    for (int c = 0; c < cs->n; ++c)
+        for (int k = 0; k < cs->m; ++k) {
+            cs->need[c][k] = s->need[rep[c]][keep[k]];
+            cs->alloc[c][k] = s->allocation[rep[c]][keep[k]];
+        }
     return 1;
 }
 
-// --- Wait-For Graph (WFG) Implementation (Deadlock Detection) ---
-
-// Builds the Wait-For Graph (T_i -> T_j if T_i needs resource r held by T_j and r is not available)
-static void build_wfg(const RailwayState *s, WFG *g) {
-    int n = s->ntrains;
-    int m = s->ntracks;
-    g->n = n;
-    
-    // Initialize graph
-    for (int i = 0; i < n; ++i)
-        for (int j = 0; j < n; ++j)
-            g->adj[i][j] = 0;
+// Banker's safety check on the compressed matrices, finishing a class in bulk
+static int compressed_safety(const CompressedState *cs) {
+    int m = cs->m;
+    int work[MAX_TRACKS];
+    int pending[MAX_TRAINS];
+    int npending = cs->n;
+    memcpy(work, cs->work, sizeof(int) * (size_t)m);
+    for (int c = 0; c < npending; ++c) pending[c] = c;
 
-    for (int i = 0; i < n; ++i) { // Train i (the potential waiter)
-        int needs_any = 0;
-        for (int r = 0; r < m; ++r) if (s->need[i][r] > 0) needs_any = 1;
-        if (!needs_any) continue; // Train i is not waiting
+    while (npending > 0) {
+        int kept = 0;
+        for (int a = 0; a < npending; ++a) {
+            int c = pending[a];
+            if (!request_le_available(m, cs->need[c], work)) { pending[kept++] = c; continue; }
+            for (int k = 0; k < m; ++k) work[k] += cs->mult[c] * cs->alloc[c][k];
+        }
+        if (kept == npending) return 0;
+        npending = kept;
+    }
+    return 1;
+}
 
-        for (int r = 0; r < m; ++r) { // Resource r
-            if (s->need[i][r] <= 0) continue; // T_i doesn't need r
+// Verdict-only check of component c, run on its compressed matrices when
+// interchangeable trains or tracks make them notably smaller
+static int component_safety_check(const RailwayState *s, int c) {
+    CompressedState cs;
+    if (s->ncomp <= 1) {
+        if (s->nactive && compress_state(s, s->active, s->nactive, -1, &cs)) return compressed_safety(&cs);
+        return safety_check(s, NULL);
+    }
+    int trains[MAX_TRAINS];
+    int nt = 0;
+    for (int a = 0; a < s->nactive; ++a) if (s->train_comp[s->active[a]] == c) trains[nt++] = s->active[a];
+    if (nt && compress_state(s, trains, nt, c, &cs)) return compressed_safety(&cs);
+    return safety_kernel(s, trains, nt, NULL);
+}
 
-            // Deadlock is only possible if the needed resource has zero available units
-            if (s->available[r] > 0) continue; 
+// Safety pass over the given trains that also measures their margin. Along the safe
+// sequence found, headroom[j] is the smallest Work[j] - Need[i][j] over trains that
+// still need track j (and never more than Available[j]). Removing that many units
+// from Available keeps the same sequence valid. Only tracks of c are meaningful.
+// If need_tid is given, it stands in for the Need row of train tid.
+static int margin_pass_as(const RailwayState *s, const int trains[], int nt, int tid, const int need_tid[],
+                          int headroom[]) {
+    int m = s->ntracks;
+    int pending[MAX_TRAINS];
+    int npending = nt, count = 0;
+    int work[MAX_TRACKS];
+    memcpy(pending, trains, sizeof(int) * (size_t)nt);
+    for (int j = 0; j < m; ++j) work[j] = headroom[j] = s->available[j];
 
-            for (int j = 0; j < n; ++j) { // Train j (the resource holder)
-                // If T_j holds resource r and is not T_i itself, then T_i waits for T_j
-                if (s->allocation[j][r] > 0 && j != i) g->adj[i][j] = 1;
+    while (npending > 0) {
+        int kept = 0;
+        for (int a = 0; a < npending; ++a) {
+            int i = pending[a];
+            const int *need = i == tid ? need_tid : s->need[i];
+            if (!request_le_available(m, need, work)) { pending[kept++] = i; continue; }
+            for (int j = 0; j < m; ++j) {
+                if (need[j] > 0 && work[j] - need[j] < headroom[j]) headroom[j] = work[j] - need[j];
+                work[j] += s->allocation[i][j];
             }
+            ++count;
         }
+        if (kept == npending) break;
+        npending = kept;
     }
+    return (count == nt);
 }
 
-// Utility function for DFS to detect a cycle (deadlock)
-static int dfs_cycle_util(const WFG *g, int u, int visited[], int stack[], int cycle_buf[], int *cycle_len) {
-    visited[u] = 1;
-    stack[u] = 1;
+static int margin_pass(const RailwayState *s, const int trains[], int nt, int headroom[]) {
+    return margin_pass_as(s, trains, nt, -1, NULL, headroom);
+}
 
-    for (int v = 0; v < g->n; ++v) {
-        if (!g->adj[u][v]) continue;
+static int component_margin_pass(const RailwayState *s, int c, int headroom[]) {
+    int trains[MAX_TRAINS];
+    int nt = 0;
+    for (int a = 0; a < s->nactive; ++a)
+        if (s->ncomp <= 1 || s->train_comp[s->active[a]] == c) trains[nt++] = s->active[a];
+    return margin_pass(s, trains, nt, headroom);
+}
+
+// Recomputes the margin (and with it the verdict) of components whose margin is stale
+static void refresh_margin(RailwayState *s) {
+    if (!s->ncomp) build_components(s);
+    int tmp[MAX_TRACKS];
+    for (int c = 0; c < s->ncomp; ++c) {
+        if (!(s->comp_stale[c] & COMP_STALE_MARGIN)) continue;
+        int ok = component_margin_pass(s, c, tmp);
+        for (int j = 0; j < s->ntracks; ++j) if (s->track_comp[j] == c) s->headroom[j] = ok ? tmp[j] : 0;
+        s->comp_safe[c] = (unsigned char)ok;
+        s->comp_stale[c] &= ~(COMP_STALE_SAFETY | COMP_STALE_MARGIN);
+    }
+}
+
+// Dashboard read of the safety margin, O(m) unless a component needs a pass:
+// returns the minimum headroom over tracks that have waiters (the tightest slack
+// of Work over Need on the safe sequence), or -1 if the state is unsafe. If track
+// is given it receives the tightest track (-1 when nobody waits).
+static int safety_margin(RailwayState *s, int *track) {
+    refresh_margin(s);
+    for (int c = 0; c < s->ncomp; ++c) if (!s->comp_safe[c]) { if (track) *track = -1; return -1; }
+    int best = -1, slack = 0;
+    for (int j = 0; j < s->ntracks; ++j)
+        if (s->track_waiters[j] && (best < 0 || s->headroom[j] < slack)) { best = j; slack = s->headroom[j]; }
+    if (track) *track = best;
+    return best < 0 ? 0 : slack;
+}
+
+// Returns the cached safety verdict of component c, recomputing it if stale
+static int component_verdict(RailwayState *s, int c) {
+    if (s->comp_stale[c] & COMP_STALE_SAFETY) {
+        s->comp_safe[c] = (unsigned char)component_safety_check(s, c);
+        s->comp_stale[c] &= ~COMP_STALE_SAFETY;
+    }
+    return s->comp_safe[c];
+}
+
+// Whole-state safety verdict assembled from per-component verdicts. Only stale
+// components are re-checked; the others reuse their cached verdict. The loop
+// stays on one thread: the whole state is at most 2048 cells, and an OpenMP
+// fork/join costs more than checking all of it.
+static int safety_check_components(RailwayState *s) {
+    if (!s->ncomp) build_components(s);
+    for (int c = 0; c < s->ncomp; ++c) component_verdict(s, c);
+
+    for (int c = 0; c < s->ncomp; ++c) if (!s->comp_safe[c]) return 0;
+    return 1;
+}
+
+// Decides a request: 1 granted, 0 denied (must wait), -1 invalid
+static int bankers_decide(RailwayState *s, int tid, const int request[]) {
+    if (!train_is_active(s, tid)) return -1;
+    int m = s->ntracks;
+    int req[MAX_TRACKS] = {0}; // Zero-padded copy for the fixed-width row kernels
+    memcpy(req, request, sizeof(int) * (size_t)m);
+    request = req;
+
+    // 1. Check if Request <= Need[tid]
+    if (!s->kern->row_le(m, request, s->need[tid])) return -1;
+
+    // 2. Check if Request <= Available
+    if (!s->kern->row_le(m, request, s->available)) return 0;
+
+    // 3. Tentatively allocate resources (modify state)
+    for (int j = 0; j < m; ++j) if (request[j]) move_units(s, tid, j, request[j]);
+
+    // 4. Check if the new state is safe. Only the requester's component changed,
+    //    every other component keeps its cached verdict.
+    if (!s->ncomp) build_components(s);
+    int c = s->train_comp[tid];
+    int ok = 1;
+    for (int k = 0; ok && k < s->ncomp; ++k) if (k != c) ok = component_verdict(s, k);
+
+    if (ok && s->comp_safe[c] && !(s->comp_stale[c] & COMP_STALE_MARGIN) && s->kern->row_le(m, request, s->headroom)) {
+        // Fast path: the grant fits in every track's headroom, so the previous safe
+        // sequence is still valid and each headroom shrinks by at most the grant
+        for (int j = 0; j < m; ++j) s->headroom[j] -= request[j];
+        s->comp_stale[c] |= COMP_STALE_WFG;
+        return 1;
+    }
+    if (ok && all_needs_fit(s)) {
+        // Fast path: every train can finish in any order, so the whole state is safe
+        // and Available - total Need is a valid headroom for every track. Tracks
+        // of c lost their old bound with the grant; elsewhere keep the larger one.
+        for (int j = 0; j < m; ++j) {
+            int h = s->available[j] - s->track_need[j], k = s->track_comp[j];
+            if (k == c || (s->comp_stale[k] & COMP_STALE_MARGIN) || h > s->headroom[j]) s->headroom[j] = h;
+        }
+        for (int k = 0; k < s->ncomp; ++k) { s->comp_safe[k] = 1; s->comp_stale[k] &= ~(COMP_STALE_SAFETY | COMP_STALE_MARGIN); }
+        s->comp_stale[c] |= COMP_STALE_WFG;
+        return 1;
+    }
+    int tmp[MAX_TRACKS];
+    if (ok) ok = component_margin_pass(s, c, tmp); // The check itself refreshes the margin
+
+    if (!ok) {
+        // State is unsafe: Rollback the allocation
+        for (int j = 0; j < m; ++j) if (request[j]) move_units(s, tid, j, -request[j]);
+        return 0;
+    }
+    
+    // Request is safe and granted
+    for (int j = 0; j < m; ++j) if (s->track_comp[j] == c) s->headroom[j] = tmp[j];
+    s->comp_safe[c] = 1;
+    s->comp_stale[c] = COMP_STALE_WFG;
+    return 1;
+}
+
+static int bankers_request(RailwayState *s, int tid, const int request[]) {
+    int r = bankers_decide(s, tid, request);
+    if (r < 0) return 0;
+    TrainWait *w = &s->waits[tid];
+    if (r) { w->streak = 0; LOG_EVENT(s, LOG_GRANT, tid, s->need_cnt[tid], 0); return 1; }
+    if (!w->streak) w->since = s->ctx->wheel.now;
+    if (w->streak < UINT16_MAX) ++w->streak;
+    if (w->streak > w->worst) w->worst = w->streak;
+    LOG_EVENT(s, LOG_DENY, tid, w->streak, 0);
+    return 0;
+}
+
+// A request the Banker's check accepts to consider: an active train asking for
+// 0..Need units of every track
+static int request_valid(const RailwayState *s, int tid, const int request[]) {
+    if (!train_is_active(s, tid)) return 0;
+    for (int j = 0; j < s->ntracks; ++j) if (request[j] < 0 || request[j] > s->need[tid][j]) return 0;
+    return 1;
+}
+
+// Starvation: denied again and again with no cycle to blame
+static int train_starving(const RailwayState *s, int tid) {
+    const TrainWait *w = &s->waits[tid];
+    return w->streak && (w->streak >= s->ctx->starve_limits.streak || s->ctx->wheel.now - w->since >= s->ctx->starve_limits.wait);
+}
+
+// --- Wait-For Graph (WFG) Implementation (Deadlock Detection) ---
+
+// Wait-For Graph construction kernel, instantiated per cell width. It walks columns:
+// the holders of each exhausted track are collected once and every waiter on that
+// track gets an edge to each of them. Being column-oriented it gains nothing from a
+// fixed row length (padded columns only add work), so it is not specialized on m.
+#define DEFINE_WFG_KERNEL(NAME, CELL, NEED, ALLOC)                                          \
+static void NAME(const RailwayState *s, WFG *g) {                                           \
+    const CELL (*need)[MAX_TRACKS] = NEED;                                                  \
+    const CELL (*alloc)[MAX_TRACKS] = ALLOC;                                                \
+    int n = s->ntrains;                                                                     \
+    int m = s->ntracks;                                                                     \
+    int holders[MAX_TRAINS];                                                                \
+    g->n = n;                                                                               \
+                                                                                            \
+    /* Initialize graph */                                                                  \
+    for (int i = 0; i < n; ++i)                                                             \
+        for (int j = 0; j < n; ++j)                                                         \
+            g->adj[i][j] = 0;                                                               \
+                                                                                            \
+    for (int r = 0; r < m; ++r) { /* Resource r */                                          \
+        /* Deadlock is only possible if the needed resource has zero available units, */    \
+        /* and only a track with both holders and waiters can produce an edge */            \
+        if (s->available[r] > 0 || !s->track_holders[r] || !s->track_waiters[r]) continue;  \
+                                                                                            \
+        int nh = 0;                                                                         \
+        for (int b = 0; b < s->nactive; ++b) /* Trains j holding r */                       \
+            if (alloc[s->active[b]][r] > 0) holders[nh++] = s->active[b];                   \
+        if (!nh) continue;                                                                  \
+                                                                                            \
+        for (int a = 0; a < s->nactive; ++a) { /* Train i (the potential waiter) */         \
+            int i = s->active[a];                                                           \
+            if (!s->need_cnt[i] || !(need[i][r] > 0)) continue; /* T_i doesn't need r */    \
+            /* T_i waits for every other holder T_j of r */                                 \
+            for (int h = 0; h < nh; ++h) if (holders[h] != i) g->adj[i][holders[h]] = 1;    \
+        }                                                                                   \
+    }                                                                                       \
+}
+
+#define KERNEL_CLASSES 6
+static const int kernel_class_m[KERNEL_CLASSES] = {0, 4, 8, 16, 32, 64};
+
+#define DEFINE_KERNEL_WIDTH(W, CELL, NEED, ALLOC)                                           \
+DEFINE_SAFETY_KERNEL(safety_##W##_mx, CELL, NEED, ALLOC, s->ntracks, NEED_STORED)           \
+DEFINE_SAFETY_KERNEL(safety_##W##_m4, CELL, NEED, ALLOC, 4, NEED_STORED)                    \
+DEFINE_SAFETY_KERNEL(safety_##W##_m8, CELL, NEED, ALLOC, 8, NEED_STORED)                    \
+DEFINE_SAFETY_KERNEL(safety_##W##_m16, CELL, NEED, ALLOC, 16, NEED_STORED)                  \
+DEFINE_SAFETY_KERNEL(safety_##W##_m32, CELL, NEED, ALLOC, 32, NEED_STORED)                  \
+DEFINE_SAFETY_KERNEL(safety_##W##_m64, CELL, NEED, ALLOC, 64, NEED_STORED)                  \
+DEFINE_WFG_KERNEL(wfg_##W, CELL, NEED, ALLOC)
+
+DEFINE_KERNEL_WIDTH(w8, uint8_t, s->cneed.w8, s->calloc.w8)
+DEFINE_KERNEL_WIDTH(w16, uint16_t, s->cneed.w16, s->calloc.w16)
+DEFINE_KERNEL_WIDTH(w32, int, s->need, s->allocation)
+
+// Fused-Need safety kernels (int cells only, Maximum is not kept in compact form)
+DEFINE_SAFETY_KERNEL(safety_fused_mx, int, s->need, s->allocation, s->ntracks, NEED_FUSED)
+DEFINE_SAFETY_KERNEL(safety_fused_m4, int, s->need, s->allocation, 4, NEED_FUSED)
+DEFINE_SAFETY_KERNEL(safety_fused_m8, int, s->need, s->allocation, 8, NEED_FUSED)
+DEFINE_SAFETY_KERNEL(safety_fused_m16, int, s->need, s->allocation, 16, NEED_FUSED)
+DEFINE_SAFETY_KERNEL(safety_fused_m32, int, s->need, s->allocation, 32, NEED_FUSED)
+DEFINE_SAFETY_KERNEL(safety_fused_m64, int, s->need, s->allocation, 64, NEED_FUSED)
+static void wfg_fused(const RailwayState *s, WFG *g) { wfg_w32(s, g); }
+
+#define KERNEL_ROW(W) {                                                                     \
+    {safety_##W##_mx, wfg_##W, request_le_available, #W " generic"},                        \
+    {safety_##W##_m4, wfg_##W, row_le_m4, #W " m=4"},                                       \
+    {safety_##W##_m8, wfg_##W, row_le_m8, #W " m=8"},                                       \
+    {safety_##W##_m16, wfg_##W, row_le_m16, #W " m=16"},                                    \
+    {safety_##W##_m32, wfg_##W, row_le_m32, #W " m=32"},                                    \
+    {safety_##W##_m64, wfg_##W, row_le_m64, #W " m=64"} }
+
+// Rows: 1-, 2- and 4-byte stored Need, then the fused-Need kernels
+#define KERNEL_ROWS 4
+static const KernelSet kernel_table[KERNEL_ROWS][KERNEL_CLASSES] = {
+    KERNEL_ROW(w8), KERNEL_ROW(w16), KERNEL_ROW(w32), KERNEL_ROW(fused)
+};
+
+// Kernel row for a cell width. Building with -DRAIL_FUSED_NEED makes the safety
+// kernels derive Need from Maximum - Allocation instead of reading the stored matrix.
+static int width_index(int cell_width) {
+#ifdef RAIL_FUSED_NEED
+    (void)cell_width;
+    return KERNEL_ROWS - 1;
+#else
+    return cell_width == 1 ? 0 : cell_width == 2 ? 1 : 2;
+#endif
+}
+
+// Dispatch: the smallest fixed row length covering ntracks for the current width
+static void select_kernels(RailwayState *s) {
+    int cls = 1;
+    while (kernel_class_m[cls] < s->ntracks) ++cls;
+    s->kern = &kernel_table[width_index(s->cell_width)][cls];
+}
+
+static int safety_kernel(const RailwayState *s, const int trains[], int nt, int safe_seq[]) {
+    return s->kern->safety(s, trains, nt, safe_seq);
+}
+
+// Builds the Wait-For Graph (T_i -> T_j if T_i needs resource r held by T_j and r is not available)
+static void build_wfg(const RailwayState *s, WFG *g) {
+    s->kern->wfg(s, g);
+}
+
+// Utility function for DFS to detect a cycle (deadlock)
+static int dfs_cycle_util(const WFG *g, int u, int visited[], int stack[], int cycle_buf[], int *cycle_len) {
+    visited[u] = 1;
+    stack[u] = 1;
+
+    for (int v = 0; v < g->n; ++v) {
+        if (!g->adj[u][v]) continue;
 
         if (!visited[v]) {
             if (dfs_cycle_util(g, v, visited, stack, cycle_buf, cycle_len)) {
                 // Cycle found in subtree, add current node to cycle path
-                if (*cycle_len < MAX_TRAINS) cycle_buf[(*cycle_len)++] = u;
+                if (*cycle_len < CYCLE_BUF_LEN) cycle_buf[(*cycle_len)++] = u;
                 return 1;
             }
         } else if (stack[v]) {
             // Cycle detected (back edge to node currently in recursion stack)
-            if (*cycle_len < MAX_TRAINS) {
+            if (*cycle_len + 2 <= CYCLE_BUF_LEN) {
                 cycle_buf[(*cycle_len)++] = v; // Start of the cycle
                 cycle_buf[(*cycle_len)++] = u; // Next node
             }
@@ -240,384 +1448,2843 @@ static int dfs_cycle_util(const WFG *g, int u, int visited[], int stack[], int c
     return 0;
 }
 
-// Main function to detect a cycle in the WFG
-static int detect_cycle_wfg(const WFG *g, int cycle_buf[], int *cycle_len) {
-    int n = g->n;
-    int visited[MAX_TRAINS] = {0};
-    int stack[MAX_TRAINS] = {0}; // Recursion stack
-    *cycle_len = 0;
+// Main function to detect a cycle in the WFG
+static int detect_cycle_wfg(const WFG *g, int cycle_buf[], int *cycle_len) {
+    int n = g->n;
+    int visited[MAX_TRAINS] = {0};
+    int stack[MAX_TRAINS] = {0}; // Recursion stack
+    int found = 0;
+    *cycle_len = 0;
+
+    for (int i = 0; i < n && !found; ++i) if (!visited[i]) {
+        found = dfs_cycle_util(g, i, visited, stack, cycle_buf, cycle_len);
+    }
+    return found;
+}
+
+// Cycle detection run per component (WFG edges never cross components), serially
+// for the same reason as safety_check_components. Components whose cached
+// verdict is a clean "no deadlock" are skipped entirely.
+static int detect_cycle_components(RailwayState *s, const WFG *g, int cycle_buf[], int *cycle_len) {
+    if (!s->ncomp) build_components(s);
+    if (!wfg_may_have_edges(s)) { // Fast path from the track aggregates: no edge, no cycle
+        for (int c = 0; c < s->ncomp; ++c) { s->comp_deadlocked[c] = 0; s->comp_stale[c] &= ~COMP_STALE_WFG; }
+        *cycle_len = 0;
+        return 0;
+    }
+    if (s->ncomp <= 1) return detect_cycle_wfg(g, cycle_buf, cycle_len);
+
+    int found_comp = -1;
+    *cycle_len = 0;
+    for (int c = 0; c < s->ncomp; ++c) {
+        if (!(s->comp_stale[c] & COMP_STALE_WFG) && !s->comp_deadlocked[c]) continue;
+
+        int visited[MAX_TRAINS] = {0};
+        int stack[MAX_TRAINS] = {0};
+        int buf[CYCLE_BUF_LEN];
+        int len = 0, hit = 0;
+        for (int i = 0; i < g->n && !hit; ++i)
+            if (s->train_comp[i] == c && !visited[i]) hit = dfs_cycle_util(g, i, visited, stack, buf, &len);
+
+        s->comp_deadlocked[c] = (unsigned char)hit;
+        s->comp_stale[c] &= ~COMP_STALE_WFG;
+        if (hit && found_comp < 0) { // Report the lowest component for stable output
+            found_comp = c;
+            memcpy(cycle_buf, buf, sizeof(int) * (size_t)len);
+            *cycle_len = len;
+        }
+    }
+    return (found_comp >= 0);
+}
+
+// --- Region-Level Detection ---
+
+// Rebuilds the WFG fragment of region r: same edge rule as the WFG kernels,
+// restricted to the region's tracks
+static void refresh_region(RailwayState *s, int r) {
+    uint32_t *adj = s->region_adj[r];
+    memset(adj, 0, sizeof(s->region_adj[r]));
+    s->region_targets[r] = s->region_waiters[r] = 0;
+    for (int j = 0; j < s->ntracks; ++j) {
+        if (s->track_region[j] != r) continue;
+        if (s->available[j] > 0 || !s->track_holders[j] || !s->track_waiters[j]) continue;
+        uint32_t holders = 0;
+        for (int a = 0; a < s->nactive; ++a)
+            if (s->allocation[s->active[a]][j] > 0) holders |= 1u << s->active[a];
+        for (int a = 0; a < s->nactive; ++a) {
+            int i = s->active[a];
+            if (s->need[i][j] > 0) adj[i] |= holders & ~(1u << i);
+        }
+    }
+    for (int i = 0; i < s->ntrains; ++i) {
+        s->region_targets[r] |= adj[i];
+        if (adj[i]) s->region_waiters[r] |= 1u << i;
+    }
+}
+
+// DFS over a bitmask graph restricted to `nodes`; fills cycle_buf like
+// dfs_cycle_util (reverse order, first entry closing the cycle)
+static int mask_cycle_util(const uint32_t adj[], uint32_t nodes, int u, uint32_t *visited, uint32_t *stack,
+                           int cycle_buf[], int *cycle_len) {
+    *visited |= 1u << u;
+    *stack |= 1u << u;
+    for (uint32_t out = adj[u] & nodes; out; out &= out - 1) {
+        int v = __builtin_ctz(out);
+        if (!(*visited & (1u << v))) {
+            if (mask_cycle_util(adj, nodes, v, visited, stack, cycle_buf, cycle_len)) {
+                if (*cycle_len < CYCLE_BUF_LEN) cycle_buf[(*cycle_len)++] = u;
+                return 1;
+            }
+        } else if (*stack & (1u << v)) {
+            if (*cycle_len + 2 <= CYCLE_BUF_LEN) {
+                cycle_buf[(*cycle_len)++] = v;
+                cycle_buf[(*cycle_len)++] = u;
+            }
+            return 1;
+        }
+    }
+    *stack &= ~(1u << u);
+    return 0;
+}
+
+static int mask_cycle(const uint32_t adj[], uint32_t nodes, int cycle_buf[], int *cycle_len) {
+    uint32_t visited = 0, stack = 0;
+    *cycle_len = 0;
+    for (uint32_t left = nodes; left; left &= left - 1) {
+        int u = __builtin_ctz(left);
+        if (!(visited & (1u << u)) && mask_cycle_util(adj, nodes, u, &visited, &stack, cycle_buf, cycle_len)) return 1;
+    }
+    return 0;
+}
+
+// Hierarchical detection. Stale region fragments are rebuilt and searched on
+// their own; a cycle through several regions makes the summary graph (region
+// r1 -> r2 when a train waited on in r1 waits in r2) cyclic, and only then is
+// the union of the fragments searched. Counts of rebuilt regions and whether
+// the search escalated go to *rebuilt and *escalated when given.
+static int detect_cycle_regions(RailwayState *s, int cycle_buf[], int *cycle_len, int *rebuilt, int *escalated) {
+    int nr = s->nregions, fresh = 0;
+    uint32_t all = 0;
+    for (int a = 0; a < s->nactive; ++a) all |= 1u << s->active[a];
+    for (int r = 0; r < nr; ++r) {
+        if (!s->region_stale[r]) continue;
+        refresh_region(s, r);
+        int len;
+        s->region_deadlocked[r] = (unsigned char)mask_cycle(s->region_adj[r], s->region_waiters[r], cycle_buf, &len);
+        s->region_stale[r] = 0;
+        ++fresh;
+    }
+    if (rebuilt) *rebuilt = fresh;
+    if (escalated) *escalated = 0;
+
+    for (int r = 0; r < nr; ++r)
+        if (s->region_deadlocked[r]) return mask_cycle(s->region_adj[r], s->region_waiters[r], cycle_buf, cycle_len);
+
+    uint32_t summary[MAX_REGIONS];
+    for (int r = 0; r < nr; ++r) {
+        summary[r] = 0;
+        for (int q = 0; q < nr; ++q)
+            if (q != r && (s->region_targets[r] & s->region_waiters[q])) summary[r] |= 1u << q;
+    }
+    int rc[CYCLE_BUF_LEN], rlen; // MAX_REGIONS <= MAX_TRAINS
+    *cycle_len = 0;
+    if (!mask_cycle(summary, nr == 32 ? ~0u : (1u << nr) - 1, rc, &rlen)) return 0;
+
+    // Escalate: search the union of the fragments
+    if (escalated) *escalated = 1;
+    uint32_t adj[MAX_TRAINS] = {0};
+    for (int r = 0; r < nr; ++r)
+        for (int i = 0; i < s->ntrains; ++i) adj[i] |= s->region_adj[r][i];
+    return mask_cycle(adj, all, cycle_buf, cycle_len);
+}
+
+// --- Symmetry Reduction ---
+
+// Trains with identical claims, holdings and routes are interchangeable: swapping
+// how far along their routes they are gives a state with the same future. Such
+// states are folded together by sorting the route positions inside each class.
+typedef struct {
+    int n;                          // Active trains covered
+    int nclass;
+    int order[MAX_TRAINS];          // Active trains grouped by class, canonical slot order
+    int start[MAX_TRAINS + 1];      // Class k occupies order[start[k] .. start[k+1])
+    int cls[MAX_TRAINS];            // Class of each train id
+} SymClasses;
+
+// Orders trains by their rows (sorted-row canonical form); 0 if interchangeable
+static int compare_train_rows(const RailwayState *s, int a, int b) {
+    if (s->route_len[a] != s->route_len[b]) return s->route_len[a] < s->route_len[b] ? -1 : 1;
+    int r = memcmp(s->route[a], s->route[b], sizeof(RouteStep) * (size_t)s->route_len[a]);
+    if (!r) r = memcmp(s->allocation[a], s->allocation[b], sizeof(int) * (size_t)s->ntracks);
+    if (!r) r = memcmp(s->maximum[a], s->maximum[b], sizeof(int) * (size_t)s->ntracks);
+    return r;
+}
+
+static void build_sym_classes(const RailwayState *s, SymClasses *sc) {
+    sc->n = s->nactive;
+    for (int a = 0; a < sc->n; ++a) { // Insertion sort, stable in train id
+        int i = s->active[a], k = a;
+        while (k > 0 && compare_train_rows(s, sc->order[k - 1], i) > 0) { sc->order[k] = sc->order[k - 1]; --k; }
+        sc->order[k] = i;
+    }
+    sc->nclass = 0;
+    for (int k = 0; k < sc->n; ++k) {
+        if (k == 0 || compare_train_rows(s, sc->order[k - 1], sc->order[k]) != 0) sc->start[sc->nclass++] = k;
+        sc->cls[sc->order[k]] = sc->nclass - 1;
+    }
+    sc->start[sc->nclass] = sc->n;
+}
+
+// Canonical form of per-train route positions: one slot per active train in
+// class order, positions sorted ascending within each class
+static void canonical_positions(const SymClasses *sc, const unsigned char pos[], unsigned char out[]) {
+    for (int c = 0; c < sc->nclass; ++c)
+        for (int k = sc->start[c]; k < sc->start[c + 1]; ++k) {
+            unsigned char v = pos[sc->order[k]];
+            int q = k;
+            while (q > sc->start[c] && out[q - 1] > v) { out[q] = out[q - 1]; --q; }
+            out[q] = v;
+        }
+}
+
+// True if an interchangeable train listed before i sits at the same position,
+// in which case moving i leads to a state symmetric to moving that train
+static int sym_duplicate_move(const SymClasses *sc, const unsigned char pos[], int i) {
+    int c = sc->cls[i];
+    for (int k = sc->start[c]; sc->order[k] != i; ++k)
+        if (pos[sc->order[k]] == pos[i]) return 1;
+    return 0;
+}
+
+// --- Lookahead Prediction ---
+
+// Default route of a train: acquire its outstanding Need track by track, then
+// release everything
+static void plan_default_route(RailwayState *s, int i) {
+    int len = 0;
+    for (int j = 0; j < s->ntracks && len < MAX_ROUTE_STEPS - 1; ++j)
+        if (s->need[i][j] > 0) s->route[i][len++] = (RouteStep){ j, s->need[i][j] };
+    s->route[i][len++] = (RouteStep){ -1, 0 };
+    s->route_len[i] = train_is_active(s, i) ? len : 0;
+}
+
+// Loaders call this once the matrices are final
+static void plan_default_routes(RailwayState *s) {
+    for (int i = 0; i < s->ntrains; ++i) plan_default_route(s, i);
+}
+
+#define PREDICT_CAN_DEADLOCK  RAILWAY_PREDICT_CAN_DEADLOCK
+#define PREDICT_MUST_DEADLOCK RAILWAY_PREDICT_MUST_DEADLOCK
+#define PREDICT_PARTIAL       RAILWAY_PREDICT_PARTIAL
+#define PREDICT_RULED_OUT     8  // Search flag: some continuation survives the horizon
+#define PREDICT_GROW          16 // Search flag: the table is half full, rerun with a larger one
+
+static uint64_t explore_fingerprint(const unsigned char pos[], int na);
+
+// Shared by every search root. A train's units only change through its own
+// steps, so the route positions of all trains determine the whole state; the
+// fingerprint of their canonical form and the remaining depth keys the
+// transposition table. An entry is that fingerprint with its low two bits
+// replaced by the PREDICT_* result, 0 marking an empty slot; as in the model
+// checker's visited set, states with equal fingerprints are merged. Roots
+// insert with a compare-and-swap, so the table needs no lock.
+typedef struct {
+    const RailwayState *s;
+    const SymClasses *sym;
+    _Atomic uint64_t *table;
+    size_t mask;
+    long budget;                   // States the whole search may expand
+    long fill;                     // States this table holds before it must grow
+    _Atomic long states;
+    _Atomic int flags;             // PREDICT_CAN_DEADLOCK, PREDICT_RULED_OUT, PREDICT_PARTIAL, PREDICT_GROW
+} PredictShared;
+
+// Working copy of one search root; roots are explored in parallel
+typedef struct {
+    PredictShared *sh;
+    int avail[MAX_TRACKS];
+    int alloc[MAX_TRAINS][MAX_TRACKS];
+    unsigned char pos[MAX_TRAINS];
+} PredictCtx;
+
+// Applies train i's next step. An acquire or release moves units of one track:
+// delta[0] receives the track, delta[1] the units, and the result is 1. Release
+// of everything fills delta[] with the units moved per track and returns 2.
+// Returns 0 (and changes nothing) if the train is done or must wait.
+static int predict_step(PredictCtx *x, int i, int delta[]) {
+    const RailwayState *s = x->sh->s;
+    if (x->pos[i] >= s->route_len[i]) return 0;
+    RouteStep st = s->route[i][x->pos[i]];
+    if (st.track < 0) {
+        for (int j = 0; j < s->ntracks; ++j) {
+            delta[j] = -x->alloc[i][j];
+            x->avail[j] += x->alloc[i][j];
+            x->alloc[i][j] = 0;
+        }
+        ++x->pos[i];
+        return 2;
+    }
+    int u, j = st.track;
+    if (st.units >= 0) {
+        int room = s->maximum[i][j] - x->alloc[i][j];
+        u = st.units;
+        if (u > room) u = room < 0 ? 0 : room;
+        if (u > x->avail[j]) return 0;
+    } else {
+        u = -st.units;
+        if (u > x->alloc[i][j]) u = x->alloc[i][j];
+        u = -u;
+    }
+    x->alloc[i][j] += u;
+    x->avail[j] -= u;
+    delta[0] = j;
+    delta[1] = u;
+    ++x->pos[i];
+    return 1;
+}
+
+// Reverts predict_step, given what it returned
+static void predict_undo(PredictCtx *x, int i, int kind, const int delta[]) {
+    if (kind == 1) {
+        x->alloc[i][delta[0]] -= delta[1];
+        x->avail[delta[0]] += delta[1];
+    } else {
+        for (int j = 0; j < x->sh->s->ntracks; ++j) { x->alloc[i][j] -= delta[j]; x->avail[j] += delta[j]; }
+    }
+    --x->pos[i];
+}
+
+// The search can stop once the budget or the table is spent, or once both
+// answers are known: a deadlock was found and some continuation avoids one
+static int predict_settled(PredictShared *sh) {
+    int f = atomic_load_explicit(&sh->flags, memory_order_relaxed);
+    return (f & (PREDICT_PARTIAL | PREDICT_GROW)) || (f & (PREDICT_CAN_DEADLOCK | PREDICT_RULED_OUT)) == (PREDICT_CAN_DEADLOCK | PREDICT_RULED_OUT);
+}
+
+static void predict_flag(PredictShared *sh, int bit) {
+    atomic_fetch_or_explicit(&sh->flags, bit, memory_order_relaxed);
+}
+
+static void predict_store(PredictShared *sh, uint64_t fp, int result) {
+    uint64_t entry = (fp & ~(uint64_t)3) | (uint64_t)result;
+    for (size_t k = fp & sh->mask;; k = (k + 1) & sh->mask) {
+        uint64_t cur = atomic_load_explicit(&sh->table[k], memory_order_relaxed);
+        if (!cur && atomic_compare_exchange_strong_explicit(&sh->table[k], &cur, entry,
+                                                             memory_order_relaxed, memory_order_relaxed)) return;
+        if ((cur & ~(uint64_t)3) == (fp & ~(uint64_t)3)) return; // Another root stored it first
+    }
+}
+
+// PREDICT_* result of the state under fp, -1 if not stored
+static int predict_lookup(PredictShared *sh, uint64_t fp) {
+    for (size_t k = fp & sh->mask;; k = (k + 1) & sh->mask) {
+        uint64_t cur = atomic_load_explicit(&sh->table[k], memory_order_relaxed);
+        if (!cur) return -1;
+        if ((cur & ~(uint64_t)3) == (fp & ~(uint64_t)3)) return (int)(cur & 3);
+    }
+}
+
+// Explores every interleaving of the next `depth` moves. A state is stuck when
+// some train still has steps left but no train can move. The return value is
+// meaningless once the search is settled.
+static int predict_search(PredictCtx *x, int depth) {
+    PredictShared *sh = x->sh;
+    const RailwayState *s = sh->s;
+    if (predict_settled(sh)) return 0;
+    unsigned char key[MAX_TRAINS] = {0};
+    canonical_positions(sh->sym, x->pos, key);
+    uint64_t fp = explore_fingerprint(key, s->nactive) ^ ((uint64_t)(depth + 1) << 58);
+    if (!(fp & ~(uint64_t)3)) fp = 4;
+    int hit = predict_lookup(sh, fp);
+    if (hit >= 0) return hit;
+    long n = atomic_fetch_add_explicit(&sh->states, 1, memory_order_relaxed);
+    if (n >= sh->budget) { predict_flag(sh, PREDICT_PARTIAL); return 0; }
+    if (n >= sh->fill) { predict_flag(sh, PREDICT_GROW); return 0; }
+
+    int delta[MAX_TRACKS];
+    int moved = 0, pending = 0, can = 0, must = 1;
+    for (int a = 0; a < s->nactive; ++a) {
+        int i = s->active[a];
+        if (x->pos[i] < s->route_len[i]) pending = 1;
+        if (sym_duplicate_move(sh->sym, x->pos, i)) continue; // Its twin already covers it
+        int kind = predict_step(x, i, delta);
+        if (!kind) continue;
+        moved = 1;
+        int r = depth > 0 ? predict_search(x, depth - 1) : 0;
+        predict_undo(x, i, kind, delta);
+        if (!depth) break; // Horizon reached: only whether anyone can move matters
+        can |= r & PREDICT_CAN_DEADLOCK;
+        if (!(r & PREDICT_MUST_DEADLOCK)) must = 0;
+        if (can && !must) break; // Both answers are settled
+    }
+    if (predict_settled(sh)) return 0; // Children were cut short; do not store
+    int result;
+    if (!moved) result = pending ? PREDICT_CAN_DEADLOCK | PREDICT_MUST_DEADLOCK : 0;
+    else result = depth ? (can | (must ? PREDICT_MUST_DEADLOCK : 0)) : 0;
+    if (result & PREDICT_CAN_DEADLOCK) predict_flag(sh, PREDICT_CAN_DEADLOCK);
+    if (!(result & PREDICT_MUST_DEADLOCK)) predict_flag(sh, PREDICT_RULED_OUT);
+
+    predict_store(sh, fp, result);
+    return result;
+}
+
+// States a search of `horizon` moves over n trains can expand: 1 + n + ... + n^horizon
+static long predict_bound(int n, int horizon, long cap) {
+    long total = 1, level = 1;
+    for (int d = 0; d < horizon && total < cap; ++d) {
+        level = level > cap / (n ? n : 1) ? cap : level * n;
+        total += level;
+    }
+    return total < cap ? total : cap;
+}
+
+// Bounded lookahead over the trains' routes: explores the next `horizon` moves
+// of all trains from the current state, expanding at most max_states states
+// (< 1 for PREDICT_MAX_STATES), and returns PREDICT_* bits. The first moves are
+// searched in parallel over one shared transposition table. It starts small
+// and, once half full, the search reruns with one four times the size, up to
+// two slots per state the budget or the horizon allows; the reruns cost at
+// most a third more. The search stops as soon as both answers are known. When
+// the budget runs out first the result carries PREDICT_PARTIAL: CAN_DEADLOCK
+// only if a deadlock was found, never MUST_DEADLOCK. -1 if there is no working
+// memory for the search.
+static int predict_deadlock(const RailwayState *s, int horizon, long max_states, long *states) {
+    if (horizon < 1) horizon = 1;
+    if (horizon > MAX_LOOKAHEAD) horizon = MAX_LOOKAHEAD;
+    if (max_states < 1) max_states = PREDICT_MAX_STATES;
+    *states = 0;
+    size_t mark = arena_mark(&s->ctx->scratch_arena);
+    PredictShared *sh = arena_zalloc(&s->ctx->scratch_arena, sizeof(PredictShared));
+    PredictCtx *root = arena_zalloc(&s->ctx->scratch_arena, sizeof(PredictCtx));
+    SymClasses *sym = arena_alloc(&s->ctx->scratch_arena, sizeof(SymClasses));
+    if (!sh || !root || !sym) { arena_release(&s->ctx->scratch_arena, mark); return -1; }
+    build_sym_classes(s, sym);
+    sh->s = s;
+    sh->sym = sym;
+    root->sh = sh;
+    memcpy(root->avail, s->available, sizeof(root->avail));
+    memcpy(root->alloc, s->allocation, sizeof(root->alloc));
+
+    // Every train that can move now starts one subtree
+    int first[MAX_TRAINS], nfirst = 0, pending = 0, delta[MAX_TRACKS];
+    for (int a = 0; a < s->nactive; ++a) {
+        int i = s->active[a];
+        if (s->route_len[i] > 0) pending = 1;
+        if (sym_duplicate_move(sym, root->pos, i)) continue;
+        int kind = predict_step(root, i, delta);
+        if (kind) { predict_undo(root, i, kind, delta); first[nfirst++] = i; }
+    }
+    if (!nfirst) {
+        arena_release(&s->ctx->scratch_arena, mark);
+        *states = 1;
+        return pending ? PREDICT_CAN_DEADLOCK | PREDICT_MUST_DEADLOCK : 0;
+    }
+    PredictCtx *ctx = arena_alloc(&s->ctx->scratch_arena, sizeof(PredictCtx) * (size_t)nfirst);
+    if (!ctx) { arena_release(&s->ctx->scratch_arena, mark); return -1; }
+
+    // The full table has two slots per state, so probes stay short and an
+    // insert always finds room
+    size_t emark = arena_mark(&s->ctx->explore_arena);
+    size_t room = s->ctx->explore_arena.size - emark;
+    sh->budget = predict_bound(s->nactive, horizon, max_states);
+    size_t full = 2;
+    while (full < 2 * (size_t)sh->budget + 2) full <<= 1;
+    while (sizeof(uint64_t) * full > room) {
+        full >>= 1;
+        sh->budget = (long)(full / 2) - 1;
+    }
+    int f;
+    for (size_t slots = full < PREDICT_MIN_SLOTS ? full : PREDICT_MIN_SLOTS;; slots = slots * 4 < full ? slots * 4 : full) {
+        sh->table = arena_zalloc(&s->ctx->explore_arena, sizeof(uint64_t) * slots);
+        if (!sh->table) {
+            arena_release(&s->ctx->explore_arena, emark);
+            arena_release(&s->ctx->scratch_arena, mark);
+            return -1;
+        }
+        sh->mask = slots - 1;
+        sh->fill = slots == full ? sh->budget : (long)(slots / 2);
+        atomic_init(&sh->states, 0);
+        atomic_init(&sh->flags, 0);
+        for (int r = 0; r < nfirst; ++r) ctx[r] = *root;
+
+        OMP_FOR_IF(nfirst > 1 && horizon > 3)
+        for (int r = 0; r < nfirst; ++r) {
+            int d[MAX_TRACKS];
+            predict_step(&ctx[r], first[r], d);
+            predict_search(&ctx[r], horizon - 1);
+        }
+        f = atomic_load(&sh->flags);
+        arena_release(&s->ctx->explore_arena, emark);
+        int both = PREDICT_CAN_DEADLOCK | PREDICT_RULED_OUT;
+        if (!(f & PREDICT_GROW) || (f & both) == both) break;
+    }
+
+    // Every terminal state reached sets a flag, so the flags alone give the answer
+    long n = atomic_load(&sh->states);
+    *states = 1 + (n < sh->budget ? n : sh->budget);
+    arena_release(&s->ctx->scratch_arena, mark);
+    if ((f & (PREDICT_CAN_DEADLOCK | PREDICT_RULED_OUT)) == (PREDICT_CAN_DEADLOCK | PREDICT_RULED_OUT))
+        return PREDICT_CAN_DEADLOCK;
+    if (f & PREDICT_PARTIAL) return (f & PREDICT_CAN_DEADLOCK) | PREDICT_PARTIAL;
+    return (f & PREDICT_CAN_DEADLOCK) | (f & PREDICT_RULED_OUT ? 0 : PREDICT_MUST_DEADLOCK);
+}
+
+// --- Exhaustive Exploration ---
+
+typedef railway_explore_t ExploreResult; // See railway.h
+
+// Routes replayed once: what each step really moves and what every train holds
+// after each prefix of its route. Trains are indexed by canonical slot (see
+// SymClasses), so explored states are canonical position vectors.
+typedef struct {
+    int na, m;
+    SymClasses sym;
+    unsigned char twin_next[MAX_TRAINS];            // Slot a + 1 holds an interchangeable train
+    int len[MAX_TRAINS];
+    short track[MAX_TRAINS][MAX_ROUTE_STEPS];       // -1 for release steps, which never block
+    int units[MAX_TRAINS][MAX_ROUTE_STEPS];         // Units an acquire step needs free
+    int taken[MAX_TRAINS][MAX_ROUTE_STEPS + 1][MAX_TRACKS]; // Held minus held at position 0
+    int avail[MAX_TRACKS];
+} ExploreModel;
+
+static void build_explore_model(const RailwayState *s, ExploreModel *em) {
+    em->na = s->nactive;
+    em->m = s->ntracks;
+    memcpy(em->avail, s->available, sizeof(em->avail));
+    build_sym_classes(s, &em->sym);
+    for (int a = 0; a < em->na; ++a) {
+        int i = em->sym.order[a];
+        em->twin_next[a] = (unsigned char)(a + 1 < em->na && em->sym.cls[em->sym.order[a + 1]] == em->sym.cls[i]);
+        int held[MAX_TRACKS];
+        memcpy(held, s->allocation[i], sizeof(held));
+        em->len[a] = s->route_len[i];
+        memset(em->taken[a][0], 0, sizeof(em->taken[a][0]));
+        for (int k = 0; k < em->len[a]; ++k) {
+            RouteStep st = s->route[i][k];
+            em->track[a][k] = -1;
+            em->units[a][k] = 0;
+            if (st.track < 0) {
+                memset(held, 0, sizeof(held));
+            } else if (st.units >= 0) { // Same capping as predict_step
+                int u = st.units, room = s->maximum[i][st.track] - held[st.track];
+                if (u > room) u = room < 0 ? 0 : room;
+                em->track[a][k] = (short)st.track;
+                em->units[a][k] = u;
+                held[st.track] += u;
+            } else {
+                int u = -st.units;
+                held[st.track] -= u > held[st.track] ? held[st.track] : u;
+            }
+            for (int j = 0; j < em->m; ++j) em->taken[a][k + 1][j] = held[j] - s->allocation[i][j];
+        }
+    }
+}
+
+// Can train a take its next step from positions pos[]?
+static int explore_can_move(const ExploreModel *em, const unsigned char pos[], int a) {
+    if (pos[a] >= em->len[a]) return 0;
+    int t = em->track[a][pos[a]];
+    if (t < 0) return 1;
+    int free_units = em->avail[t];
+    for (int b = 0; b < em->na; ++b) free_units -= em->taken[b][pos[b]][t];
+    return em->units[a][pos[a]] <= free_units;
+}
+
+// 64-bit fingerprint of a position vector; 0 marks empty visited slots
+static uint64_t explore_fingerprint(const unsigned char pos[], int na) {
+    uint64_t h = 1469598103934665603ull;
+    for (int a = 0; a < na; ++a) { h ^= pos[a]; h *= 1099511628211ull; }
+    h ^= h >> 29; h *= 0xbf58476d1ce4e5b9ull; h ^= h >> 32;
+    return h ? h : 1;
+}
+
+// Hash-compacted visited set: only fingerprints are stored, so two states with
+// the same 64-bit fingerprint are merged (a ~n^2/2^65 chance over n states).
+// Returns 1 if fp was newly inserted.
+static int visited_insert(uint64_t *table, size_t mask, uint64_t fp) {
+    for (size_t k = fp & mask;; k = (k + 1) & mask) {
+        if (table[k] == fp) return 0;
+        if (!table[k]) { table[k] = fp; return 1; }
+    }
+}
+
+// Breadth-first exploration of every interleaving of the trains' routes from the
+// current state, up to max_states distinct states (< 1 for EXPLORE_MAX_STATES,
+// fewer if the store cannot hold that many). Frontier batches are expanded
+// in parallel; new states are deduplicated in order, so the first stuck state
+// found is the shallowest and trace[] (train ids, one per move) is a shortest
+// counterexample. Returns whether a deadlock is reachable, -1 if the state store
+// cannot be allocated.
+static int explore_states(const RailwayState *s, long max_states, ExploreResult *out, int trace[]) {
+    memset(out, 0, sizeof(*out));
+    size_t mark = arena_mark(&s->ctx->explore_arena);
+    ExploreModel *em = arena_alloc(&s->ctx->explore_arena, sizeof(ExploreModel));
+    if (!em) return -1;
+    build_explore_model(s, em);
+    int na = em->na;
+
+    // Budget the store: positions, parent and mover per state plus at least two
+    // visited slots per state, after the per-batch buffers
+    size_t batch = sizeof(uint64_t) * EXPLORE_CHUNK * (size_t)(na ? na : 1) + EXPLORE_CHUNK + 256;
+    size_t room = s->ctx->explore_arena.size - arena_mark(&s->ctx->explore_arena) - batch;
+    size_t record = (size_t)na + sizeof(uint32_t) + 1;
+    if (max_states < 1) max_states = EXPLORE_MAX_STATES;
+    if ((size_t)max_states > room / record) max_states = (long)(room / record); // More never fits
+    size_t slots = 2;
+    while (slots < 2 * (size_t)max_states) slots <<= 1;
+    while (sizeof(uint64_t) * slots + record * (size_t)max_states > room) {
+        slots >>= 1;
+        max_states = (long)(slots / 2);
+    }
+
+    uint64_t *visited = arena_zalloc(&s->ctx->explore_arena, sizeof(uint64_t) * slots);
+    unsigned char *pos = arena_alloc(&s->ctx->explore_arena, (size_t)na * (size_t)max_states + 1);
+    uint32_t *parent = arena_alloc(&s->ctx->explore_arena, sizeof(uint32_t) * (size_t)max_states);
+    unsigned char *mover = arena_alloc(&s->ctx->explore_arena, (size_t)max_states);
+    uint64_t *cand = arena_alloc(&s->ctx->explore_arena, sizeof(uint64_t) * EXPLORE_CHUNK * (size_t)(na ? na : 1));
+    unsigned char *stuck = arena_alloc(&s->ctx->explore_arena, EXPLORE_CHUNK);
+    if (!visited || !pos || !parent || !mover || !cand || !stuck) {
+        arena_release(&s->ctx->explore_arena, mark);
+        return -1;
+    }
+
+    memset(pos, 0, (size_t)na);
+    visited_insert(visited, slots - 1, explore_fingerprint(pos, na));
+    parent[0] = 0;
+    mover[0] = 0;
+    long nstates = 1, begin = 0, end = 1, found = -1;
+    int full = 0;
+
+    while (begin < end && found < 0 && !full) {
+        for (long base = begin; base < end && found < 0 && !full; base += EXPLORE_CHUNK) {
+            long nb = end - base < EXPLORE_CHUNK ? end - base : EXPLORE_CHUNK;
+
+            // Expand the batch: successor fingerprints (0 = blocked) and stuck flags
+            OMP_FOR_IF(nb >= 1024)
+            for (long f = 0; f < nb; ++f) {
+                const unsigned char *p = pos + (size_t)(base + f) * (size_t)na;
+                unsigned char q[MAX_TRAINS];
+                int moved = 0, pending = 0;
+                memcpy(q, p, (size_t)na);
+                for (int a = 0; a < na; ++a) {
+                    uint64_t fp = 0;
+                    if (p[a] < em->len[a]) pending = 1;
+                    // Of interchangeable trains at one position only the last moves:
+                    // that keeps its class sorted, so the successor stays canonical
+                    int twin = em->twin_next[a] && p[a + 1] == p[a];
+                    if (!twin && explore_can_move(em, p, a)) {
+                        ++q[a];
+                        fp = explore_fingerprint(q, na);
+                        --q[a];
+                        moved = 1;
+                    }
+                    cand[(size_t)f * (size_t)na + (size_t)a] = fp;
+                }
+                stuck[f] = (unsigned char)(!moved && pending);
+            }
+
+            // Merge in frontier order so results do not depend on thread timing
+            for (long f = 0; f < nb && found < 0 && !full; ++f) {
+                if (stuck[f]) { found = base + f; break; }
+                for (int a = 0; a < na; ++a) {
+                    uint64_t fp = cand[(size_t)f * (size_t)na + (size_t)a];
+                    if (!fp) continue;
+                    ++out->transitions;
+                    if (!visited_insert(visited, slots - 1, fp)) continue;
+                    if (nstates >= max_states) { full = 1; break; }
+                    unsigned char *q = pos + (size_t)nstates * (size_t)na;
+                    memcpy(q, pos + (size_t)(base + f) * (size_t)na, (size_t)na);
+                    ++q[a];
+                    parent[nstates] = (uint32_t)(base + f);
+                    mover[nstates] = (unsigned char)a;
+                    ++nstates;
+                }
+            }
+        }
+        if (found < 0 && !full) ++out->depth;
+        begin = end;
+        end = nstates;
+    }
+
+    out->states = nstates;
+    out->complete = !full;
+    out->classes = em->sym.nclass;
+    if (found >= 0) {
+        // Walk back to the root, then replay forward mapping each canonical slot
+        // to a real train of that class standing at the slot's position
+        out->deadlock = 1;
+        int len = 0;
+        for (long v = found; v != 0; v = parent[v]) trace[len++] = (int)v;
+        out->trace_len = len;
+        int at[MAX_TRAINS] = {0};
+        for (int k = 0; k < len / 2; ++k) { int t = trace[k]; trace[k] = trace[len - 1 - k]; trace[len - 1 - k] = t; }
+        for (int k = 0; k < len; ++k) {
+            long v = trace[k];
+            int a = mover[v], c = em->sym.cls[em->sym.order[a]];
+            int want = pos[(size_t)parent[v] * (size_t)na + (size_t)a], tid = -1;
+            for (int q = em->sym.start[c]; q < em->sym.start[c + 1] && tid < 0; ++q)
+                if (at[em->sym.order[q]] == want) tid = em->sym.order[q];
+            ++at[tid];
+            trace[k] = tid;
+        }
+    }
+    arena_release(&s->ctx->explore_arena, mark);
+    return out->deadlock;
+}
+
+// Exports the Resource Allocation Graph (RAG) and WFG to a Graphviz DOT file
+// Returns 0, or -1 if the file cannot be written (errno tells why)
+static int export_dot(const RailwayState *s, const WFG *g, const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f) return -1;
+    fprintf(f, "digraph RailwayRAG {\n");
+    fprintf(f, " \trankdir=LR;\n");
+
+    // 1. Define nodes: Trains (circles) and Resources (boxes)
+    for (int a = 0; a < s->nactive; ++a) {
+        int i = s->active[a];
+        fprintf(f, " \tT%d [shape=circle,label=\"%s\"];\n", i, train_name(s, i));
+    }
+    for (int j = 0; j < s->ntracks; ++j) fprintf(f, " \tR%d [shape=box,label=\"%s\\n(av:%d)\"];\n", j, track_name(s, j), s->available[j]);
+    
+    // 2. Add Resource Allocation Graph (RAG) edges
+    for (int a = 0; a < s->nactive; ++a)
+        for (int i = s->active[a], j = 0; j < s->ntracks; ++j) {
+            // Allocation Edge: Resource -> Train (Solid line)
+            if (s->allocation[i][j] > 0) fprintf(f, " \tR%d -> T%d [label=\"%d\"];\n", j, i, s->allocation[i][j]);
+            // Request Edge: Train -> Resource (Dashed line)
+            if (s->need[i][j] > 0) fprintf(f, " \tT%d -> R%d [label=\"need:%d\", style=dashed];\n", i, j, s->need[i][j]);
+        }
+    
+    // 3. Add Wait-For Graph (WFG) edges (Red lines)
+    for (int i = 0; i < g->n; ++i)
+        for (int j = 0; j < g->n; ++j)
+            if (g->adj[i][j]) fprintf(f, " \tT%d -> T%d [color=red];\n", i, j);
+            
+    fprintf(f, "}\n");
+    return fclose(f) ? -1 : 0;
+}
+
+// --- Deadlock Recovery Functions ---
+
+// Releases everything train tid holds and frees its slot (termination and retirement)
+static void remove_train(RailwayState *s, int tid) {
+    for (int j = 0; j < s->ntracks; ++j) set_cell(s, tid, j, 0, 0);
+    s->route_len[tid] = 0;
+    memset(&s->waits[tid], 0, sizeof(s->waits[tid]));
+    s->deferred_claims &= ~(1u << tid);
+    deactivate_train(s, tid);
+    mark_train_dirty(s, tid);
+}
+
+// Simulates termination of a train, releasing its tracks
+static int terminate_train(RailwayState *s, int tid) {
+    if (!train_is_active(s, tid)) return 0;
+    remove_train(s, tid);
+    LOG_EVENT(s, LOG_TERMINATE, tid, 0, 0);
+    return 1;
+}
+
+// Revises the maximum claim of train tid after a reroute, keeping what it holds
+// (every new claim must cover its allocation and fit the track). Lowering a
+// claim only shrinks Need and can never make the state unsafe, so it needs no
+// check. A raise is first tried against the cached margin: when each increase
+// fits the headroom of its track the old safe sequence still works and the
+// headroom just shrinks by it; otherwise the component gets one safety pass.
+// Returns 1 if applied, 0 if the raise would be unsafe (nothing changes), -1 if
+// the revision is invalid.
+static int revise_claim(RailwayState *s, int tid, const int new_max[]) {
+    if (!train_is_active(s, tid)) return -1;
+    int m = s->ntracks;
+    int old[MAX_TRACKS], grow[MAX_TRACKS] = {0};
+    int raised = 0, bridged = 0;
+    if (!s->ncomp) build_components(s);
+    int c = s->train_comp[tid];
+    for (int j = 0; j < m; ++j) {
+        if (new_max[j] < s->allocation[tid][j] || new_max[j] > track_capacity(s, j)) return -1;
+        if (new_max[j] > s->maximum[tid][j]) { grow[j] = new_max[j] - s->maximum[tid][j]; raised = 1; }
+        if (new_max[j] > 0 && s->track_comp[j] != c) bridged = 1; // Joins another component
+    }
+    memcpy(old, s->maximum[tid], sizeof(int) * (size_t)m);
+    for (int j = 0; j < m; ++j)
+        if (new_max[j] != old[j]) set_cell(s, tid, j, s->allocation[tid][j], new_max[j]);
+
+    int ok = 1;
+    if (!raised) {
+        mark_train_dirty(s, tid); // Same effect on the caches as a release
+    } else if (bridged) {
+        s->ncomp = 0;
+        ok = safety_check_components(s);
+    } else {
+        for (int k = 0; ok && k < s->ncomp; ++k) if (k != c) ok = component_verdict(s, k);
+        if (ok && s->comp_safe[c] && !(s->comp_stale[c] & COMP_STALE_MARGIN) && s->kern->row_le(m, grow, s->headroom)) {
+            for (int j = 0; j < m; ++j) s->headroom[j] -= grow[j];
+            s->comp_stale[c] |= COMP_STALE_WFG;
+        } else if (ok) {
+            int tmp[MAX_TRACKS];
+            ok = component_margin_pass(s, c, tmp);
+            if (ok) {
+                for (int j = 0; j < m; ++j) if (s->track_comp[j] == c) s->headroom[j] = tmp[j];
+                s->comp_safe[c] = 1;
+                s->comp_stale[c] = COMP_STALE_WFG;
+            }
+        }
+    }
+    if (!ok) {
+        for (int j = 0; j < m; ++j)
+            if (new_max[j] != old[j]) set_cell(s, tid, j, s->allocation[tid][j], old[j]);
+        if (bridged) s->ncomp = 0;
+        LOG_EVENT(s, LOG_REVISE, tid, 0, 0);
+        return 0;
+    }
+    LOG_EVENT(s, LOG_REVISE, tid, 1, 0);
+    s->deferred_claims &= ~(1u << tid); // Supersedes any deferred revision
+    plan_default_route(s, tid);
+    return 1;
+}
+
+// Keeps an unsafe revision to be retried by retry_deferred_claims
+static void defer_claim(RailwayState *s, int tid, const int new_max[]) {
+    memcpy(s->deferred_max[tid], new_max, sizeof(int) * (size_t)s->ntracks);
+    s->deferred_claims |= 1u << tid;
+}
+
+// Retries every deferred revision; those that turned invalid are dropped.
+// Returns how many were applied.
+static int retry_deferred_claims(RailwayState *s) {
+    int applied = 0;
+    for (uint32_t left = s->deferred_claims; left; left &= left - 1) {
+        int tid = __builtin_ctz(left);
+        int r = revise_claim(s, tid, s->deferred_max[tid]);
+        if (r > 0) ++applied;
+        else if (r < 0) s->deferred_claims &= ~(1u << tid);
+    }
+    return applied;
+}
+
+// Retires a train that has completed (no outstanding Need), returning its units.
+// O(m); the slot is reused by the next admission.
+static int retire_train(RailwayState *s, int tid) {
+    if (!train_is_active(s, tid) || s->need_cnt[tid]) return 0;
+    remove_train(s, tid);
+    LOG_EVENT(s, LOG_RETIRE, tid, 0, 0);
+    return 1;
+}
+
+// Admits a new train with claim max[] at runtime, in a free slot if there is one.
+// It holds nothing yet, so the state stays safe with it exactly when it was safe
+// before and no claim exceeds its track's capacity: the old safe sequence hands
+// every unit back, after which the newcomer can finish. With the component
+// verdicts cached the test is O(m). Returns the new train id, -1 if refused.
+static int admit_train(RailwayState *s, const int max[], const char *name) {
+    for (int j = 0; j < s->ntracks; ++j)
+        if (max[j] < 0 || max[j] > track_capacity(s, j)) return -1;
+    if (!safety_check_components(s)) return -1;
+
+    // Name the slot first: the only step that can still fail. The slot's previous
+    // name is released with the next compaction of the name table.
+    int tid = s->nfree ? s->free_slots[s->nfree - 1] : s->ntrains;
+    if (tid >= MAX_TRAINS) return -1;
+    char buf[MAX_NAME_LEN];
+    if (!name || !name[0]) {
+        snprintf(buf, sizeof(buf), "Train%d", tid);
+        name = buf;
+    }
+    NameTable *names = &s->ctx->names;
+    int off = intern_name(names, name, 1);
+    if (off < 0) return -1;
+    names->train_name[tid] = off;
+    if (s->nfree) --s->nfree;
+    else {
+        s->ntrains++;
+        names->ntrains = s->ntrains;
+        s->need_cnt[tid] = 0;
+        s->row_sig[tid] = 0;
+    }
+    index_train_names(names);
+
+    int pos = s->nactive++;
+    for (; pos > 0 && s->active[pos - 1] > tid; --pos) {
+        s->active[pos] = s->active[pos - 1];
+        s->active_pos[s->active[pos]] = pos;
+    }
+    s->active[pos] = tid;
+    s->active_pos[tid] = pos;
+    ++s->train_gen[tid]; // Requests still queued for the old occupant are dropped
+    s->ctx->wheel.needs_recovery &= ~(1u << tid);
+    memset(&s->waits[tid], 0, sizeof(s->waits[tid]));
+    for (int j = 0; j < s->ntracks; ++j) set_cell(s, tid, j, 0, max[j]);
+
+    // Join the component of the claimed tracks. The verdicts stay valid (still
+    // safe; holding nothing, the newcomer is on no cycle) but its Need lowers the
+    // margin. Claims bridging components force a rebuild.
+    int c = -1;
+    for (int j = 0; j < s->ntracks && s->ncomp; ++j) {
+        if (!max[j] || c == s->track_comp[j]) continue;
+        if (c < 0) c = s->track_comp[j];
+        else s->ncomp = 0;
+    }
+    if (s->ncomp && c < 0 && s->ncomp < MAX_COMPONENTS) {
+        c = s->ncomp++;
+        s->comp_stale[c] = COMP_STALE_ALL;
+    }
+    if (c >= 0 && s->ncomp) {
+        s->train_comp[tid] = c;
+        s->comp_stale[c] |= COMP_STALE_MARGIN;
+    } else s->ncomp = 0;
+
+    plan_default_route(s, tid);
+    LOG_EVENT(s, LOG_ADMIT, tid, 0, 0);
+    return tid;
+}
+
+// Simulates preemption (taking tracks) from a train
+static int preempt_from_train(RailwayState *s, int tid, const int preempt[]) {
+    if (!train_is_active(s, tid)) return 0;
+    for (int j = 0; j < s->ntracks; ++j) {
+        int take = preempt[j];
+        if (take < 0) take = 0;
+        // Ensure we don't take more than allocated
+        if (take > s->allocation[tid][j]) take = s->allocation[tid][j]; 
+        
+        if (take) move_units(s, tid, j, -take); // Need grows back by the units taken
+    }
+    mark_train_dirty(s, tid);
+    LOG_EVENT(s, LOG_RELEASE, tid, 0, 0);
+    return 1;
+}
+
+// Changes the capacity of track j at runtime (closures and reopenings). Units
+// held beyond the new capacity are preempted, starting with the holder that
+// still needs the most tracks (the least progress lost); taken[] receives the
+// units taken per train id. Only the component of track j is revalidated, and
+// only if some train needs the track or it was unsafe. Returns the safety
+// verdict of the whole state, -1 for invalid arguments.
+static int set_track_capacity(RailwayState *s, int j, int cap, int taken[MAX_TRAINS]) {
+    if (j < 0 || j >= s->ntracks || cap < 0) return -1;
+    memset(taken, 0, sizeof(int) * MAX_TRAINS);
+    while (s->track_alloc[j] > cap) {
+        int victim = -1;
+        for (int a = 0; a < s->nactive; ++a) {
+            int i = s->active[a];
+            if (!s->allocation[i][j]) continue;
+            if (victim < 0 || s->need_cnt[i] > s->need_cnt[victim] ||
+                (s->need_cnt[i] == s->need_cnt[victim] && s->allocation[i][j] > s->allocation[victim][j])) victim = i;
+        }
+        int take = s->track_alloc[j] - cap;
+        if (take > s->allocation[victim][j]) take = s->allocation[victim][j];
+        move_units(s, victim, j, -take);
+        mark_train_dirty(s, victim);
+        taken[victim] += take;
+    }
+
+    int delta = cap - s->track_alloc[j] - s->available[j];
+    s->available[j] += delta;
+    s->region_stale[s->track_region[j]] = 1;
+    if (!s->ncomp) build_components(s);
+    int c = s->track_comp[j];
+    if (!(s->comp_stale[c] & COMP_STALE_MARGIN) && s->comp_safe[c]) {
+        s->headroom[j] += delta; // Work on every step of the safe sequence moves by delta
+        if (s->headroom[j] < 0) { s->headroom[j] = 0; s->comp_stale[c] |= COMP_STALE_SAFETY | COMP_STALE_MARGIN; }
+    } else if (delta) {
+        s->comp_stale[c] |= COMP_STALE_SAFETY | COMP_STALE_MARGIN;
+    }
+    s->comp_stale[c] |= COMP_STALE_WFG;
+    LOG_EVENT(s, LOG_CAPACITY, -1, j, cap);
+    return safety_check_components(s);
+}
+
+// --- Route Selection ---
+
+// Hop counts from every track to dst over the topology (-1 if unreachable)
+static void track_distances(const RailwayState *s, int dst, int dist[]) {
+    for (int j = 0; j < s->ntracks; ++j) dist[j] = -1;
+    uint64_t seen = 1ull << dst, frontier = seen;
+    for (int d = 0; frontier; ++d) {
+        uint64_t next = 0;
+        for (uint64_t f = frontier; f; f &= f - 1) {
+            int j = __builtin_ctzll(f);
+            dist[j] = d;
+            next |= s->track_links[j];
+        }
+        frontier = next & ~seen;
+        seen |= next;
+    }
+}
+
+// One candidate path, first track to last (see railway.h)
+typedef railway_route_t RouteCandidate;
+
+typedef struct {
+    const RailwayState *s;
+    const int *dist;
+    int limit;                        // Longest path accepted, in tracks
+    int budget;                       // Extensions left
+    int path[MAX_ROUTE_STEPS - 1];
+    RouteCandidate *out;
+    int nout;
+} RouteSearch;
+
+// Depth-first over simple paths that stay within rs->limit tracks, trying the
+// neighbours closest to the destination first so the shortest path comes first
+static void route_search(RouteSearch *rs, int j, int len, uint64_t used) {
+    rs->path[len++] = j;
+    if (rs->dist[j] == 0) {
+        RouteCandidate *c = &rs->out[rs->nout++];
+        c->len = len;
+        memcpy(c->track, rs->path, sizeof(int) * (size_t)len);
+        return;
+    }
+    for (int d = rs->dist[j] - 1; d <= rs->dist[j] + 1; ++d) {
+        if (len + 1 + d > rs->limit) break;
+        for (uint64_t nb = rs->s->track_links[j] & ~used; nb; nb &= nb - 1) {
+            int k = __builtin_ctzll(nb);
+            if (rs->dist[k] != d) continue;
+            if (rs->nout == MAX_ROUTE_CANDIDATES || --rs->budget < 0) return;
+            route_search(rs, k, len, used | 1ull << k);
+        }
+    }
+}
+
+// Up to MAX_ROUTE_CANDIDATES simple paths from src to dst, at most ROUTE_DETOUR
+// tracks longer than the shortest one. Returns how many were found.
+static int find_candidate_routes(const RailwayState *s, int src, int dst, RouteCandidate out[]) {
+    int dist[MAX_TRACKS];
+    track_distances(s, dst, dist);
+    if (dist[src] < 0) return 0;
+    RouteSearch rs = { s, dist, dist[src] + 1 + ROUTE_DETOUR, ROUTE_SEARCH_BUDGET, {0}, out, 0 };
+    if (rs.limit > MAX_ROUTE_STEPS - 1) rs.limit = MAX_ROUTE_STEPS - 1;
+    if (dist[src] + 1 <= rs.limit) route_search(&rs, src, 0, 1ull << src);
+    return rs.nout;
+}
+
+// Claim of train tid for running path c with `units` on each of its tracks:
+// what it holds everywhere, raised to `units` on the path. -1 if a path track
+// is too small.
+static int route_claim(const RailwayState *s, int tid, const RouteCandidate *c, int units, int new_max[]) {
+    for (int j = 0; j < s->ntracks; ++j) new_max[j] = s->allocation[tid][j];
+    for (int k = 0; k < c->len; ++k) {
+        int j = c->track[k];
+        if (units > track_capacity(s, j)) return -1;
+        if (units > new_max[j]) new_max[j] = units;
+    }
+    return 0;
+}
+
+// Scores path c against a copy of the train's Need row under the path's claim;
+// the state itself is not touched. Only the components the train and the claim
+// reach get a margin pass, the others keep their maintained headroom.
+static void score_route(RailwayState *s, int tid, RouteCandidate *c, int units) {
+    int new_max[MAX_TRACKS], need[MAX_TRACKS], headroom[MAX_TRACKS], trains[MAX_TRAINS];
+    unsigned char touched[MAX_COMPONENTS] = {0};
+    int m = s->ntracks, nt = 0;
+    c->margin = c->slack = -1;
+    if (route_claim(s, tid, c, units, new_max) < 0) return;
+    refresh_margin(s);
+    touched[s->train_comp[tid]] = 1;
+    for (int j = 0; j < m; ++j) {
+        need[j] = new_max[j] - s->allocation[tid][j];
+        if (need[j] > 0) touched[s->track_comp[j]] = 1;
+    }
+    for (int k = 0; k < s->ncomp; ++k) if (!touched[k] && !s->comp_safe[k]) return;
+    for (int a = 0; a < s->nactive; ++a)
+        if (touched[s->train_comp[s->active[a]]]) trains[nt++] = s->active[a];
+    if (!margin_pass_as(s, trains, nt, tid, need, headroom)) return;
+    for (int j = 0; j < m; ++j) {
+        int waiters = s->track_waiters[j] - (s->need[tid][j] > 0) + (need[j] > 0);
+        if (!touched[s->track_comp[j]]) headroom[j] = s->headroom[j];
+        if (waiters && (c->margin < 0 || headroom[j] < c->margin)) c->margin = headroom[j];
+    }
+    if (c->margin < 0) c->margin = 0; // Nobody waits
+    for (int k = 0; k < c->len; ++k)
+        if (c->slack < 0 || headroom[c->track[k]] < c->slack) c->slack = headroom[c->track[k]];
+}
+
+// Routes train tid from track src to dst: every candidate path is scored by the
+// margin the state keeps with the train's claim for it (ties go to the larger
+// slack on the path, then the shorter path), and the best safe one becomes the
+// train's claim and route. cand[] receives all scored candidates. Returns the
+// index of the chosen one, -1 if no path keeps the state safe.
+static int choose_route(RailwayState *s, int tid, int src, int dst, int units, RouteCandidate cand[], int *ncand) {
+    *ncand = 0;
+    if (!train_is_active(s, tid) || src < 0 || src >= s->ntracks || dst < 0 || dst >= s->ntracks || units < 1) return -1;
+    *ncand = find_candidate_routes(s, src, dst, cand);
+    int best = -1;
+    for (int k = 0; k < *ncand; ++k) {
+        RouteCandidate *c = &cand[k];
+        score_route(s, tid, c, units);
+        if (c->margin < 0) continue;
+        if (best < 0 || c->margin > cand[best].margin ||
+            (c->margin == cand[best].margin && (c->slack > cand[best].slack ||
+             (c->slack == cand[best].slack && c->len < cand[best].len)))) best = k;
+    }
+    if (best < 0) return -1;
+
+    int new_max[MAX_TRACKS];
+    route_claim(s, tid, &cand[best], units, new_max);
+    if (revise_claim(s, tid, new_max) != 1) return -1;
+    int len = 0;
+    for (int k = 0; k < cand[best].len; ++k) {
+        int j = cand[best].track[k];
+        if (s->need[tid][j] > 0) s->route[tid][len++] = (RouteStep){ j, s->need[tid][j] };
+    }
+    s->route[tid][len++] = (RouteStep){ -1, 0 };
+    s->route_len[tid] = len;
+    return best;
+}
+
+// --- Request Deadlines ---
+
+static int wheel_slot(uint32_t expires, int level) {
+    return (int)((expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+}
+
+// Unlinks and returns the list in the slot of tick t at the given level
+static uint32_t wheel_take(TimerWheel *w, uint32_t t, int level) {
+    int slot = wheel_slot(t, level);
+    uint32_t k = w->head[level][slot];
+    w->head[level][slot] = NIL_PENDING;
+    w->occupied[level] &= ~(1ull << slot);
+    return k;
+}
+
+// Ticks after now on which advance_clock has nothing to do: no level-0 slot
+// comes due and no occupied higher slot cascades. UINT32_MAX if the wheel is empty.
+static uint32_t wheel_idle_ticks(const TimerWheel *w) {
+    uint64_t next = UINT64_MAX;
+    for (int l = 0; l < WHEEL_LEVELS; ++l) {
+        if (!w->occupied[l]) continue;
+        uint64_t span = 1ull << (WHEEL_BITS * l);
+        uint64_t first = (w->now & ~(span - 1)) + span;        // Next tick on which level l is visited
+        int from = wheel_slot((uint32_t)first, l);
+        uint64_t rot = (w->occupied[l] >> from) | (w->occupied[l] << ((WHEEL_SLOTS - from) & (WHEEL_SLOTS - 1)));
+        uint64_t at = first + span * (uint64_t)__builtin_ctzll(rot) - w->now;
+        if (at < next) next = at;
+    }
+    return next == UINT64_MAX ? UINT32_MAX : (uint32_t)(next - 1);
+}
+
+// Links node k into the slot of its deadline: the lowest level whose span from
+// now still covers it. O(1).
+static void wheel_link(TimerWheel *w, uint32_t k) {
+    PendingRequest *p = &w->pool[k];
+    uint32_t delta = p->expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1u << (WHEEL_BITS * (level + 1)))) ++level;
+    int slot = wheel_slot(p->expires, level);
+    p->next = w->head[level][slot];
+    w->head[level][slot] = k;
+    w->occupied[level] |= 1ull << slot;
+}
+
+// Queues a denied request to be retried after `wait` ticks. Returns 0 if the
+// pool is full or cannot be allocated, or a unit count does not fit the compact
+// request record.
+static int queue_request(RailwayState *s, int tid, const int request[], uint32_t wait) {
+    TimerWheel *w = &s->ctx->wheel;
+    if (!w->pool) {
+        size_t mark = arena_mark(&s->ctx->scenario_arena);
+        w->pool = arena_alloc(&s->ctx->scenario_arena, sizeof(PendingRequest) * PENDING_MAX);
+        w->units = arena_alloc(&s->ctx->scenario_arena, sizeof(uint16_t) * (size_t)s->ntracks * PENDING_MAX);
+        if (!w->pool || !w->units) {
+            arena_release(&s->ctx->scenario_arena, mark);
+            w->pool = NULL;
+            return 0;
+        }
+        for (int l = 0; l < WHEEL_LEVELS; ++l)
+            for (int k = 0; k < WHEEL_SLOTS; ++k) w->head[l][k] = NIL_PENDING;
+        w->free_head = NIL_PENDING;
+    }
+    for (int j = 0; j < s->ntracks; ++j) if (request[j] < 0 || request[j] > UINT16_MAX) return 0;
+    uint32_t k;
+    if (w->free_head != NIL_PENDING) { k = w->free_head; w->free_head = w->pool[k].next; }
+    else if (w->used < PENDING_MAX) k = w->used++;
+    else return 0;
+
+    uint16_t *u = w->units + (size_t)k * (size_t)s->ntracks;
+    for (int j = 0; j < s->ntracks; ++j) u[j] = (uint16_t)request[j];
+    w->pool[k].tid = (short)tid;
+    w->pool[k].boosts = 0;
+    w->pool[k].gen = s->train_gen[tid];
+    w->pool[k].expires = w->now + (wait ? wait : 1);
+    wheel_link(w, k);
+    ++w->count;
+    return 1;
+}
+
+static void release_pending(TimerWheel *w, uint32_t k) {
+    w->pool[k].next = w->free_head;
+    w->free_head = k;
+    --w->count;
+}
+
+typedef railway_clock_stats_t DeadlineStats;
+
+// Retries a timed-out request. Denied again, it is re-armed with a boost (a wait
+// of WHEEL_SLOTS >> boosts ticks, and retried ahead of less boosted requests
+// expiring on the same tick); once out of boosts the train is flagged for
+// recovery. A request no longer within the train's Need (its claim was revised
+// or partly granted meanwhile) is dropped, not counted as a denial.
+static void expire_request(RailwayState *s, uint32_t k, DeadlineStats *st) {
+    TimerWheel *w = &s->ctx->wheel;
+    PendingRequest *p = &w->pool[k];
+    if (!train_is_active(s, p->tid) || p->gen != s->train_gen[p->tid]) { ++st->dropped; release_pending(w, k); return; }
+    int req[MAX_TRACKS] = {0};
+    const uint16_t *u = w->units + (size_t)k * (size_t)s->ntracks;
+    for (int j = 0; j < s->ntracks; ++j) req[j] = u[j];
+    if (!s->kern->row_le(s->ntracks, req, s->need[p->tid])) { ++st->dropped; release_pending(w, k); return; }
+    ++st->retried;
+    if (bankers_request(s, p->tid, req)) { ++st->granted; release_pending(w, k); return; }
+    if (p->boosts >= PENDING_MAX_BOOSTS) {
+        w->needs_recovery |= 1u << p->tid;
+        LOG_EVENT(s, LOG_ESCALATE, p->tid, 0, 0);
+        ++st->escalated;
+        release_pending(w, k);
+        return;
+    }
+    ++p->boosts;
+    ++st->boosted;
+    p->expires = w->now + ((uint32_t)WHEEL_SLOTS >> p->boosts);
+    wheel_link(w, k);
+}
+
+// Advances the clock, cascading higher wheel levels down as their slots come due
+// and retrying every request that reaches its deadline; runs of ticks on which
+// no occupied slot is visited are skipped in one step. Deferred
+// claim revisions are retried once at the end. Returns 0, or -1 (the clock left
+// alone) if there is no working memory for the due list.
+static int advance_clock(RailwayState *s, uint32_t ticks, DeadlineStats *st) {
+    TimerWheel *w = &s->ctx->wheel;
+    memset(st, 0, sizeof(*st));
+    if (!w->pool) { w->now += ticks; st->revised = retry_deferred_claims(s); return 0; }
+    size_t mark = arena_mark(&s->ctx->scratch_arena);
+    uint32_t *due = arena_alloc(&s->ctx->scratch_arena, sizeof(uint32_t) * PENDING_MAX);
+    if (!due) return -1;
+    for (uint32_t left = ticks; left; ) {
+        uint32_t idle = wheel_idle_ticks(w);
+        if (idle >= left) { w->now += left; break; }
+        w->now += idle + 1;
+        left -= idle + 1;
+        for (int l = 1; l < WHEEL_LEVELS; ++l) {
+            if (w->now & ((1u << (WHEEL_BITS * l)) - 1)) break;
+            uint32_t k = wheel_take(w, w->now, l);
+            while (k != NIL_PENDING) { uint32_t next = w->pool[k].next; wheel_link(w, k); k = next; }
+        }
+        uint32_t n = 0;
+        for (uint32_t k = wheel_take(w, w->now, 0); k != NIL_PENDING; k = w->pool[k].next) due[n++] = k;
+        for (int b = PENDING_MAX_BOOSTS; b >= 0; --b) // Boosted requests go first
+            for (uint32_t q = 0; q < n; ++q)
+                if (due[q] != NIL_PENDING && w->pool[due[q]].boosts == b) { expire_request(s, due[q], st); due[q] = NIL_PENDING; }
+    }
+    arena_release(&s->ctx->scratch_arena, mark);
+    st->revised = retry_deferred_claims(s);
+    return 0;
+}
+
+// --- Scenario Initialization Functions ---
+
+// Per-caller pseudo-random numbers (rand() would share one sequence between handles)
+static int rand_next(unsigned *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    unsigned x = *seed ^ (*seed >> 16); // The LCG's low bits repeat quickly; mix in the high ones
+    x *= 0x45d9f3bu;
+    return (int)((x ^ (x >> 16)) & 0x7fffffff);
+}
+
+// Initializes a random, multi-unit scenario (best for testing non-binary values).
+// Returns 0, or -1 for invalid sizes.
+static int fill_random_railway(RailwayState *s, int ntrains, int ntracks, int max_units_per_track, unsigned seed) {
+    if (max_units_per_track < 1 || init_empty(s, ntrains, ntracks)) return -1;
+    if (!seed) seed = (unsigned)time(NULL);
+
+    // 1. Set total available (Work pool is initialized later)
+    for (int j = 0; j < ntracks; ++j) s->available[j] = 1 + (rand_next(&seed) % max_units_per_track);
+
+    // 2. Allocate resources randomly
+    for (int j = 0; j < ntracks; ++j) {
+        // A generous maximum capacity to ensure resources can be distributed
+        int cap = s->available[j] + ntrains * max_units_per_track; 
+        if (cap < 1) cap = 1;
+        
+        // Randomly decide how many resources in total will be allocated
+        int remaining = rand_next(&seed) % (cap + 1); 
+        
+        for (int i = 0; i < ntrains; ++i) {
+            int take = remaining ? (rand_next(&seed) % (remaining + 1)) : 0;
+            s->allocation[i][j] = take;
+            remaining -= take;
+        }
+    }
+    // The units set in step 1 stay free on top of what was allocated, so total
+    // capacity = allocated + available; compute_need builds the per-track totals.
+
+    // 3. Set Maximum (Allocation + random Need)
+    for (int i = 0; i < ntrains; ++i)
+        for (int j = 0; j < ntracks; ++j)
+            s->maximum[i][j] = s->allocation[i][j] + (rand_next(&seed) % (max_units_per_track + 1));
+
+    // 4. Extra links on top of the line, giving alternative routes
+    for (int k = 0; k < ntracks / 2; ++k) {
+        int a = rand_next(&seed) % ntracks, b = rand_next(&seed) % ntracks;
+        if (a != b) link_tracks(s, a, b);
+    }
+            
+    compute_need(s);
+    plan_default_routes(s);
+    return 0;
+}
+
+// Initializes a specific non-deadlocked sample scenario (mostly binary)
+static void sample_railway(RailwayState *s) {
+    init_empty(s, 5, 5);
+    set_train_name(s, 0, "A");
+    set_train_name(s, 1, "B");
+    set_train_name(s, 2, "C");
+    set_train_name(s, 3, "D");
+    set_train_name(s, 4, "E");
+    set_track_name(s, 0, "T0");
+    set_track_name(s, 1, "T1");
+    set_track_name(s, 2, "T2");
+    set_track_name(s, 3, "T3");
+    set_track_name(s, 4, "T4");
+
+    // Available Resources (Tracks)
+    s->available[0] = 1;
+    s->available[1] = 1;
+    s->available[2] = 0;
+    s->available[3] = 1;
+    s->available[4] = 0;
+
+    // Maximum Demand Matrix M
+    int M[5][5] = {
+        {1,1,1,0,0},
+        {0,1,0,1,0},
+        {0,0,1,0,1},
+        {0,1,0,1,0},
+        {1,0,0,0,1}
+    };
+    // Allocation Matrix A
+    int A[5][5] = {
+        {0,0,0,0,0},
+        {0,1,0,0,0},
+        {0,0,1,0,0},
+        {0,0,0,0,0},
+        {1,0,0,0,0}
+    };
+    
+    for (int i = 0; i < 5; ++i)
+        for (int j = 0; j < 5; ++j) {
+            s->maximum[i][j] = M[i][j];
+            s->allocation[i][j] = A[i][j];
+        }
+    compute_need(s);
+    plan_default_routes(s);
+}
+
+// --- Library API ---
+
+railway_t *railway_create(void) {
+    railway_t *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->scenario_arena.size = SCENARIO_ARENA_BYTES;
+    r->scratch_arena.size = SCRATCH_ARENA_BYTES;
+    r->explore_arena.size = EXPLORE_ARENA_BYTES;
+    r->starve_limits = (StarvationLimits){ 8, 256 };
+    r->state.ctx = r;
+    sample_railway(&r->state);
+    return r;
+}
+
+void railway_destroy(railway_t *r) {
+    if (!r) return;
+    railway_admission_stop(r);
+    railway_log_close(r, NULL);
+    free(r->scenario_arena.base);
+    free(r->scratch_arena.base);
+    free(r->explore_arena.base);
+    free(r);
+}
+
+railway_t *railway_clone(const railway_t *r) {
+    if (r->admission) return NULL;
+    railway_t *c = malloc(sizeof(*c));
+    if (!c) return NULL;
+    *c = *r;
+    c->state.ctx = c;
+    c->scenario_arena = (Arena){ NULL, SCENARIO_ARENA_BYTES, 0 };
+    c->scratch_arena = (Arena){ NULL, SCRATCH_ARENA_BYTES, 0 };
+    c->explore_arena = (Arena){ NULL, EXPLORE_ARENA_BYTES, 0 };
+    c->admission = NULL;
+    c->log = NULL;
+    if (r->wheel.pool) { // The queued requests are the scenario arena's only contents
+        unsigned char *base = arena_alloc(&c->scenario_arena, r->scenario_arena.used);
+        if (!base) { free(c->scenario_arena.base); free(c); return NULL; }
+        memcpy(base, r->scenario_arena.base, r->scenario_arena.used);
+        c->wheel.pool = (PendingRequest *)(base + ((unsigned char *)r->wheel.pool - r->scenario_arena.base));
+        c->wheel.units = (uint16_t *)(base + ((unsigned char *)r->wheel.units - r->scenario_arena.base));
+    }
+    return c;
+}
+
+int railway_load_sample(railway_t *r) {
+    sample_railway(&r->state);
+    return 0;
+}
+
+int railway_load_random(railway_t *r, int ntrains, int ntracks, int max_units_per_track, unsigned seed) {
+    return fill_random_railway(&r->state, ntrains, ntracks, max_units_per_track, seed);
+}
+
+int railway_load(railway_t *r, int ntrains, int ntracks, const int available[],
+                 const int allocation[], const int maximum[]) {
+    if (ntrains < 1 || ntrains > MAX_TRAINS || ntracks < 1 || ntracks > MAX_TRACKS) return -1;
+    for (int j = 0; j < ntracks; ++j) if (available[j] < 0) return -1;
+    for (int k = 0; k < ntrains * ntracks; ++k)
+        if (allocation[k] < 0 || maximum[k] < allocation[k]) return -1;
+    RailwayState *s = &r->state;
+    if (init_empty(s, ntrains, ntracks)) return -1;
+    memcpy(s->available, available, sizeof(int) * (size_t)ntracks);
+    for (int i = 0; i < ntrains; ++i) {
+        memcpy(s->allocation[i], allocation + (size_t)i * (size_t)ntracks, sizeof(int) * (size_t)ntracks);
+        memcpy(s->maximum[i], maximum + (size_t)i * (size_t)ntracks, sizeof(int) * (size_t)ntracks);
+    }
+    compute_need(s);
+    plan_default_routes(s);
+    return 0;
+}
+
+int railway_ntrains(const railway_t *r) { return r->state.ntrains; }
+int railway_ntracks(const railway_t *r) { return r->state.ntracks; }
+int railway_train_active(const railway_t *r, int tid) { return train_is_active(&r->state, tid); }
+
+const char *railway_train_name(const railway_t *r, int tid) {
+    return tid >= 0 && tid < r->state.ntrains ? train_name(&r->state, tid) : NULL;
+}
+
+int railway_find_train(const railway_t *r, const char *name) { return find_train(&r->state, name); }
+
+int railway_set_train_name(railway_t *r, int tid, const char *name) {
+    if (tid < 0 || tid >= r->state.ntrains) return -1;
+    return set_train_name(&r->state, tid, name);
+}
+
+int railway_set_track_name(railway_t *r, int track, const char *name) {
+    if (track < 0 || track >= r->state.ntracks) return -1;
+    return set_track_name(&r->state, track, name);
+}
+
+const char *railway_track_name(const railway_t *r, int track) {
+    return track >= 0 && track < r->state.ntracks ? track_name(&r->state, track) : NULL;
+}
+
+int railway_capacity(const railway_t *r, int track) {
+    return track >= 0 && track < r->state.ntracks ? track_capacity(&r->state, track) : -1;
+}
+
+int railway_available(const railway_t *r, int track) {
+    return track >= 0 && track < r->state.ntracks ? r->state.available[track] : -1;
+}
+
+int railway_allocation(const railway_t *r, int tid, int track) {
+    if (tid < 0 || tid >= r->state.ntrains || track < 0 || track >= r->state.ntracks) return -1;
+    return r->state.allocation[tid][track];
+}
+
+int railway_need(const railway_t *r, int tid, int track) {
+    if (tid < 0 || tid >= r->state.ntrains || track < 0 || track >= r->state.ntracks) return -1;
+    return r->state.need[tid][track];
+}
+
+int railway_maximum(const railway_t *r, int tid, int track) {
+    if (tid < 0 || tid >= r->state.ntrains || track < 0 || track >= r->state.ntracks) return -1;
+    return r->state.maximum[tid][track];
+}
+
+int railway_request(railway_t *r, int tid, const int request[]) {
+    if (!request_valid(&r->state, tid, request)) return -1;
+    return bankers_request(&r->state, tid, request);
+}
+
+int railway_queue_request(railway_t *r, int tid, const int request[], unsigned wait) {
+    // Deadlines beyond the wheel's range would wrap into an earlier slot
+    if (wait == 0 || wait >= 1u << (WHEEL_BITS * WHEEL_LEVELS)) return -1;
+    if (!request_valid(&r->state, tid, request)) return -1;
+    return queue_request(&r->state, tid, request, wait) ? 0 : -1;
+}
+
+int railway_advance_clock(railway_t *r, unsigned ticks, railway_clock_stats_t *stats) {
+    DeadlineStats st;
+    if (advance_clock(&r->state, ticks, &st)) return -1;
+    if (stats) *stats = st;
+    return (int)st.granted;
+}
+
+unsigned railway_clock(const railway_t *r) { return r->wheel.now; }
+int railway_pending(const railway_t *r) { return (int)r->wheel.count; }
+
+int railway_needs_recovery(const railway_t *r, int tid) {
+    return tid >= 0 && tid < r->state.ntrains && (r->wheel.needs_recovery >> tid & 1u);
+}
+
+int railway_release(railway_t *r, int tid, const int units[]) {
+    return preempt_from_train(&r->state, tid, units) ? 0 : -1;
+}
+
+int railway_terminate(railway_t *r, int tid) {
+    return terminate_train(&r->state, tid) ? 0 : -1;
+}
+
+int railway_is_safe(railway_t *r, int seq[]) {
+    int safe = safety_check_components(&r->state);
+    if (safe && seq) safety_check(&r->state, seq);
+    return safe;
+}
+
+int railway_margin(railway_t *r, int *track) { return safety_margin(&r->state, track); }
+
+int railway_headroom(railway_t *r, int track) {
+    if (track < 0 || track >= r->state.ntracks) return -1;
+    refresh_margin(&r->state);
+    return r->state.headroom[track];
+}
+
+int railway_safety_rounds(railway_t *r, int seq[]) {
+    int rounds, tmp[MAX_TRAINS];
+    if (!safety_check_components(&r->state)) return -1;
+    safety_check_rounds(&r->state, seq ? seq : tmp, &rounds);
+    return rounds;
+}
+
+int railway_components(railway_t *r) {
+    if (!r->state.ncomp) build_components(&r->state);
+    return r->state.ncomp;
+}
+
+// A DFS record holds the back-edge target, then the path back up to the root;
+// the cycle is the stretch up to the target's second appearance. Writes it in
+// wait order to cycle (when given) and returns its length.
+static int cycle_from_record(const int buf[], int n, int cycle[]) {
+    int c = 1;
+    while (c < n - 1 && buf[c] != buf[0]) ++c;
+    for (int k = 0; cycle && k < c; ++k) cycle[k] = buf[c - k];
+    return c;
+}
+
+int railway_detect(railway_t *r, int cycle[], int *len) {
+    RailwayState *s = &r->state;
+    size_t mark = arena_mark(&r->scratch_arena);
+    WFG *g = arena_alloc(&r->scratch_arena, sizeof(WFG));
+    if (!g) return -1;
+    int buf[CYCLE_BUF_LEN], n = 0;
+    build_wfg(s, g);
+    int found = detect_cycle_components(s, g, buf, &n);
+    arena_release(&r->scratch_arena, mark);
+    int c = found ? cycle_from_record(buf, n, cycle) : 0;
+    if (len) *len = c;
+    return found;
+}
+
+int railway_detect_regions(railway_t *r, int cycle[], int *len, int *rebuilt, int *escalated) {
+    int buf[CYCLE_BUF_LEN], n = 0;
+    int found = detect_cycle_regions(&r->state, buf, &n, rebuilt, escalated);
+    int c = found ? cycle_from_record(buf, n, cycle) : 0;
+    if (len) *len = c;
+    return found;
+}
+
+int railway_regions(const railway_t *r) { return r->state.nregions; }
+
+int railway_wait_graph(railway_t *r, unsigned long waits[]) {
+    size_t mark = arena_mark(&r->scratch_arena);
+    WFG *g = arena_alloc(&r->scratch_arena, sizeof(WFG));
+    if (!g) return -1;
+    build_wfg(&r->state, g);
+    memset(waits, 0, sizeof(unsigned long) * MAX_TRAINS);
+    for (int a = 0; a < g->n; ++a)
+        for (int b = 0; b < g->n; ++b) if (g->adj[a][b]) waits[a] |= 1ul << b;
+    arena_release(&r->scratch_arena, mark);
+    return 0;
+}
+
+int railway_set_starvation_limits(railway_t *r, int streak, unsigned wait) {
+    if (streak < 1 || wait < 1) return -1;
+    r->starve_limits = (StarvationLimits){ streak, wait };
+    return 0;
+}
+
+void railway_starvation_limits(const railway_t *r, int *streak, unsigned *wait) {
+    if (streak) *streak = r->starve_limits.streak;
+    if (wait) *wait = r->starve_limits.wait;
+}
+
+int railway_starving(const railway_t *r, int tid) {
+    return train_is_active(&r->state, tid) && train_starving(&r->state, tid);
+}
+
+int railway_denials(const railway_t *r, int tid, int *worst, unsigned *since) {
+    if (tid < 0 || tid >= r->state.ntrains) return -1;
+    const TrainWait *w = &r->state.waits[tid];
+    if (worst) *worst = w->worst;
+    if (since) *since = w->since;
+    return w->streak;
+}
+
+int railway_admit(railway_t *r, const int maximum[], const char *name) {
+    return admit_train(&r->state, maximum, name);
+}
+
+int railway_retire(railway_t *r, int tid) { return retire_train(&r->state, tid) ? 0 : -1; }
+
+int railway_revise_claim(railway_t *r, int tid, const int maximum[]) {
+    return revise_claim(&r->state, tid, maximum);
+}
+
+int railway_defer_claim(railway_t *r, int tid, const int maximum[]) {
+    RailwayState *s = &r->state;
+    if (!train_is_active(s, tid)) return -1;
+    for (int j = 0; j < s->ntracks; ++j)
+        if (maximum[j] < s->allocation[tid][j] || maximum[j] > track_capacity(s, j)) return -1;
+    defer_claim(s, tid, maximum);
+    return 0;
+}
+
+int railway_set_capacity(railway_t *r, int track, int capacity, int taken[]) {
+    int tmp[MAX_TRAINS];
+    int safe = set_track_capacity(&r->state, track, capacity, tmp);
+    if (safe >= 0 && taken) memcpy(taken, tmp, sizeof(tmp));
+    return safe;
+}
+
+int railway_route(const railway_t *r, int tid, int tracks[], int units[]) {
+    const RailwayState *s = &r->state;
+    if (!train_is_active(s, tid)) return -1;
+    for (int k = 0; k < s->route_len[tid]; ++k) {
+        tracks[k] = s->route[tid][k].track;
+        units[k] = s->route[tid][k].units;
+    }
+    return s->route_len[tid];
+}
+
+int railway_set_route(railway_t *r, int tid, int len, const int tracks[], const int units[]) {
+    RailwayState *s = &r->state;
+    if (!train_is_active(s, tid) || len < 0 || len > MAX_ROUTE_STEPS) return -1;
+    for (int k = 0; k < len; ++k) if (tracks[k] < -1 || tracks[k] >= s->ntracks) return -1;
+    for (int k = 0; k < len; ++k) s->route[tid][k] = (RouteStep){ tracks[k], units[k] };
+    s->route_len[tid] = len;
+    return 0;
+}
+
+int railway_link_tracks(railway_t *r, int a, int b) {
+    int m = r->state.ntracks;
+    if (a < 0 || b < 0 || a >= m || b >= m || a == b) return -1;
+    link_tracks(&r->state, a, b);
+    return 0;
+}
+
+int railway_plan_route(railway_t *r, int tid, int src, int dst, int units, railway_route_t cand[], int *ncand) {
+    return choose_route(&r->state, tid, src, dst, units, cand, ncand);
+}
+
+int railway_predict(railway_t *r, int horizon, long max_states, long *states) {
+    long tmp;
+    return predict_deadlock(&r->state, horizon, max_states, states ? states : &tmp);
+}
+
+int railway_explore(railway_t *r, long max_states, railway_explore_t *out, int trace[]) {
+    railway_explore_t tmp;
+    int *buf = trace;
+    size_t mark = arena_mark(&r->scratch_arena);
+    if (!buf && !(buf = arena_alloc(&r->scratch_arena, sizeof(int) * MAX_TRACE))) return -1;
+    int found = explore_states(&r->state, max_states, out ? out : &tmp, buf);
+    arena_release(&r->scratch_arena, mark);
+    return found;
+}
+
+int railway_checkpoint_save(railway_t *r, const char *note) { return save_checkpoint(&r->state, note); }
+int railway_checkpoint_restore(railway_t *r, int idx) { return restore_checkpoint(&r->state, idx); }
+
+const char *railway_checkpoint_note(const railway_t *r, int idx) {
+    return idx >= 0 && idx < MAX_CHECKPOINTS && r->checkpoints[idx].valid ? r->checkpoints[idx].note : NULL;
+}
+
+int railway_export_dot(railway_t *r, const char *path) {
+    size_t mark = arena_mark(&r->scratch_arena);
+    WFG *g = arena_alloc(&r->scratch_arena, sizeof(WFG));
+    if (!g) return -1;
+    build_wfg(&r->state, g);
+    int rc = export_dot(&r->state, g, path);
+    arena_release(&r->scratch_arena, mark);
+    return rc;
+}
+
+// --- Admission Thread ---
+
+// Instead of locking a shared handle, producers can submit every mutation
+// through a lock-free multi-producer ring to one admission thread. That thread
+// alone calls into the handle, applies mutations in batches through the same
+// entry points as any other client, and posts each result to the submitting
+// producer's completion slot. A mutation takes well under a microsecond, so
+// handing it to another thread only pays off when the consumer has a core of
+// its own; menu 26 measures it against a mutex around each call.
+enum {
+    MUT_REQUEST = RAILWAY_SUBMIT_REQUEST,
+    MUT_RELEASE = RAILWAY_SUBMIT_RELEASE,
+    MUT_REVISE = RAILWAY_SUBMIT_REVISE
+};
+
+// One ring entry. seq follows the bounded-queue sequence scheme: it equals the
+// ring position when the slot is free for that position, position + 1 once the
+// mutation is published.
+typedef struct {
+    _Atomic size_t seq;
+    int kind, tid, producer;
+    uint32_t ticket;
+    int units[MAX_TRACKS];          // Request, release, or new claim row
+} RingSlot;
+
+// Written by the admission thread, waited on by one producer
+typedef struct {
+    _Alignas(64) _Atomic uint32_t done;     // Ticket of the last completed mutation
+    int result;
+    uint32_t ticket;                        // Last ticket issued (producer only)
+} Completion;
+
+typedef struct AdmissionRing {
+    RingSlot slot[RING_SLOTS];
+    _Alignas(64) _Atomic size_t tail;       // Next position producers claim
+    _Alignas(64) size_t head;               // Next position consumed (admission thread only)
+    long batches;                           // Passes that applied at least one mutation
+    Completion done[MAX_PRODUCERS];
+    _Atomic int stop;
+    railway_t *r;
+    int ntracks;                            // Fixed while the thread runs
+    pthread_t thread;
+} AdmissionRing;
+
+static int apply_mutation(railway_t *r, const RingSlot *m) {
+    switch (m->kind) {
+    case MUT_REQUEST: return railway_request(r, m->tid, m->units);
+    case MUT_RELEASE: return railway_release(r, m->tid, m->units);
+    case MUT_REVISE:  return railway_revise_claim(r, m->tid, m->units);
+    }
+    return -1;
+}
+
+static void *admission_main(void *arg) {
+    AdmissionRing *q = arg;
+    int idle = 0;
+    for (;;) {
+        int n = 0;
+        for (; n < ADMIT_BATCH; ++n) {
+            size_t pos = q->head;
+            RingSlot *m = &q->slot[pos & (RING_SLOTS - 1)];
+            if (atomic_load_explicit(&m->seq, memory_order_acquire) != pos + 1) break;
+            Completion *c = &q->done[m->producer];
+            c->result = apply_mutation(q->r, m);
+            atomic_store_explicit(&c->done, m->ticket, memory_order_release);
+            atomic_store_explicit(&m->seq, pos + RING_SLOTS, memory_order_release); // Free for the next lap
+            q->head = pos + 1;
+        }
+        if (n) { ++q->batches; idle = 0; }
+        else if (atomic_load_explicit(&q->stop, memory_order_acquire) &&
+                 q->head == atomic_load_explicit(&q->tail, memory_order_acquire)) break; // Every claimed slot applied
+        else if (++idle > 256) sched_yield(); // Spin briefly before giving up the core
+    }
+    return NULL;
+}
+
+int railway_admission_start(railway_t *r) {
+    if (r->admission) return -1;
+    AdmissionRing *q = aligned_alloc(_Alignof(AdmissionRing), sizeof(AdmissionRing));
+    if (!q) return -1;
+    for (size_t k = 0; k < RING_SLOTS; ++k) atomic_init(&q->slot[k].seq, k);
+    atomic_init(&q->tail, 0);
+    q->head = 0;
+    q->batches = 0;
+    for (int p = 0; p < MAX_PRODUCERS; ++p) {
+        atomic_init(&q->done[p].done, 0);
+        q->done[p].ticket = 0;
+    }
+    atomic_init(&q->stop, 0);
+    q->r = r;
+    q->ntracks = r->state.ntracks;
+    if (pthread_create(&q->thread, NULL, admission_main, q) != 0) { free(q); return -1; }
+    r->admission = q;
+    return 0;
+}
+
+long railway_admission_stop(railway_t *r) {
+    AdmissionRing *q = r->admission;
+    if (!q) return -1;
+    atomic_store(&q->stop, 1);
+    pthread_join(q->thread, NULL);
+    long batches = q->batches;
+    r->admission = NULL;
+    free(q);
+    return batches;
+}
+
+int railway_submit(railway_t *r, int producer, int kind, int tid, const int units[]) {
+    AdmissionRing *q = r->admission;
+    if (!q || producer < 0 || producer >= MAX_PRODUCERS || kind < MUT_REQUEST || kind > MUT_REVISE) return -1;
+    Completion *c = &q->done[producer];
+    uint32_t ticket = ++c->ticket;
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    RingSlot *m;
+    for (;;) {
+        m = &q->slot[pos & (RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&m->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else {
+            if (seq < pos) sched_yield(); // Ring full: the consumer is a lap behind
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    m->kind = kind;
+    m->tid = tid;
+    m->producer = producer;
+    m->ticket = ticket;
+    memcpy(m->units, units, sizeof(int) * (size_t)q->ntracks);
+    atomic_store_explicit(&m->seq, pos + 1, memory_order_release);
+
+    for (int spins = 0; atomic_load_explicit(&c->done, memory_order_acquire) != ticket; )
+        if (++spins > 256) sched_yield();
+    return c->result;
+}
+
+int railway_log_open(railway_t *r, const char *path, int raw) {
+    if (r->log) return -1;
+    EventLog *l = aligned_alloc(_Alignof(EventLog), sizeof(EventLog));
+    if (!l) return -1;
+    memset(l, 0, sizeof(*l));
+    if (!(l->out = fopen(path, raw ? "wb" : "w"))) { free(l); return -1; }
+    l->raw = raw;
+    if (pthread_create(&l->drainer, NULL, log_drainer_main, l) != 0) { fclose(l->out); free(l); return -1; }
+    r->log = l;
+    return 0;
+}
+
+int railway_log_is_open(const railway_t *r) {
+    return r->log != NULL;
+}
+
+int railway_log_stats(const railway_t *r, long *queued, long *dropped) {
+    EventLog *l = r->log;
+    if (!l) return -1;
+    if (queued) *queued = (long)(atomic_load(&l->tail) - atomic_load(&l->head));
+    if (dropped) *dropped = l->dropped;
+    return 0;
+}
+
+long railway_log_close(railway_t *r, long *dropped) {
+    EventLog *l = r->log;
+    if (!l) return -1;
+    r->log = NULL;
+    atomic_store(&l->stop, 1);
+    pthread_join(l->drainer, NULL);
+    fclose(l->out);
+    long written = l->written;
+    if (dropped) *dropped += l->dropped;
+    free(l);
+    return written;
+}
+
+#ifndef RAILWAY_NO_MAIN
+// --- Kernel Benchmark Hook ---
+
+// Timings of engine internals that no API call exposes, for the menu's kernel
+// benchmark. Not part of railway.h; everything else the menu shows comes
+// through the API.
+typedef struct {
+    const char *name[3];                    // Generic, selected and fused-Need kernels
+    double safety[3], wfg[3], row_le[3];    // ns per call
+    double compressed;                      // Verdict through class compression
+    int classes, class_tracks;              // 0 classes: compression not worth it
+    double need_full, need_row;             // Need recompute vs one-row release and regrant
+    double log_record;                      // ns per record, < 0 with the log closed
+    int cell_width;
+} KernelBench;
+
+// Returns 0, or -1 if there is no working memory
+static int benchmark_kernels(railway_t *r, int iters, KernelBench *b) {
+    RailwayState *s = &r->state;
+    const KernelSet *generic = &kernel_table[width_index(s->cell_width)][0];
+    const KernelSet *fused = &kernel_table[KERNEL_ROWS - 1][s->kern - kernel_table[width_index(s->cell_width)]];
+    const KernelSet *kernels[3] = { generic, s->kern, fused };
+    size_t mark = arena_mark(&r->scratch_arena);
+    WFG *g = arena_alloc(&r->scratch_arena, sizeof(WFG));
+    RailwayState *tmp = arena_alloc(&r->scratch_arena, sizeof(RailwayState));
+    CompressedState *cs = arena_alloc(&r->scratch_arena, sizeof(CompressedState));
+    if (!g || !tmp || !cs) { arena_release(&r->scratch_arena, mark); return -1; }
+    volatile int sink = 0;
+
+    b->cell_width = s->cell_width;
+    for (int k = 0; k < 3; ++k) {
+        long long t0 = now_ns();
+        for (int it = 0; it < iters; ++it) sink += kernels[k]->safety(s, s->active, s->nactive, NULL);
+        long long t1 = now_ns();
+        for (int it = 0; it < iters; ++it) { kernels[k]->wfg(s, g); sink += g->adj[0][0]; }
+        long long t2 = now_ns();
+        for (int it = 0; it < iters; ++it) { // A passing compare, as on the grant path
+            const int *row = s->need[s->active[it % s->nactive]];
+            sink += kernels[k]->row_le(s->ntracks, row, row);
+        }
+        long long t3 = now_ns();
+        b->name[k] = kernels[k]->name;
+        b->safety[k] = (double)(t1 - t0) / iters;
+        b->wfg[k] = (double)(t2 - t1) / iters;
+        b->row_le[k] = (double)(t3 - t2) / iters;
+    }
+
+    int used = s->nactive ? compress_state(s, s->active, s->nactive, -1, cs) : 0;
+    long long tc0 = now_ns();
+    for (int it = 0; it < iters; ++it)
+        sink += s->nactive && compress_state(s, s->active, s->nactive, -1, cs) ? compressed_safety(cs) : safety_check(s, NULL);
+    b->compressed = (double)(now_ns() - tc0) / iters;
+    b->classes = used ? cs->n : 0;
+    b->class_tracks = used ? cs->m : 0;
+
+    *tmp = *s;
+    long long t0 = now_ns();
+    for (int it = 0; it < iters; ++it) compute_need(tmp);
+    long long t1 = now_ns();
+    for (int it = 0; it < iters; ++it) {
+        int t = tmp->active[it % tmp->nactive];
+        for (int j = 0; j < tmp->ntracks; ++j) {
+            int held = tmp->allocation[t][j];
+            if (held) { move_units(tmp, t, j, -held); move_units(tmp, t, j, held); }
+        }
+    }
+    long long t2 = now_ns();
+    b->need_full = (double)(t1 - t0) / iters;
+    b->need_row = (double)(t2 - t1) / iters;
+
+    b->log_record = -1.0;
+    if (r->log) { // Per-decision logging cost with the drainer running
+        long long tl0 = now_ns();
+        for (int it = 0; it < iters; ++it) LOG_EVENT(s, LOG_GRANT, it % s->ntrains, it, 0);
+        b->log_record = (double)(now_ns() - tl0) / iters;
+    }
+    (void)sink;
+    arena_release(&r->scratch_arena, mark);
+    return 0;
+}
+#endif
+
+// Everything below is the interactive simulator, a client of the API above
+#ifndef RAILWAY_NO_MAIN
+
+// ANSI Color Codes for enhanced terminal output
+static const char *C_RESET = "\x1b[0m";
+static const char *C_BOLD = "\x1b[1m";
+static const char *C_RED = "\x1b[31m";
+static const char *C_GREEN = "\x1b[32m";
+static const char *C_YELLOW = "\x1b[33m";
+static const char *C_BLUE = "\x1b[34m";
+static const char *C_MAGENTA = "\x1b[35m";
+static const char *C_CYAN = "\x1b[36m";
+
+// Fatal error handler
+static void die(const char *s) {
+    fprintf(stderr, "Fatal: %s\n", s);
+    exit(EXIT_FAILURE);
+}
+
+// --- Display Functions ---
+
+// Text is formatted into one buffer and written with a single fwrite whenever it
+// fills, instead of a printf per cell
+typedef struct {
+    char buf[OUT_BUF_BYTES];
+    size_t len;
+} OutBuf;
+
+static void ob_flush(OutBuf *o) {
+    fwrite(o->buf, 1, o->len, stdout);
+    o->len = 0;
+}
+
+static void ob_char(OutBuf *o, char c) {
+    if (o->len == sizeof(o->buf)) ob_flush(o);
+    o->buf[o->len++] = c;
+}
+
+static void ob_str(OutBuf *o, const char *str) {
+    while (*str) ob_char(o, *str++);
+}
 
-    for (int i = 0; i < n; ++i) if (!visited[i]) {
-        if (dfs_cycle_util(g, i, visited, stack, cycle_buf, cycle_len)) return 1;
-    }
-    return 0;
+// Left-aligned and padded to width
+static void ob_pad(OutBuf *o, const char *str, int width) {
+    int n = 0;
+    for (; str[n]; ++n) ob_char(o, str[n]);
+    for (; n < width; ++n) ob_char(o, ' ');
 }
 
-// Exports the Resource Allocation Graph (RAG) and WFG to a Graphviz DOT file
-static void export_dot(const RailwayState *s, const WFG *g, const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-        fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
-        return;
-    }
-    fprintf(f, "digraph RailwayRAG {\n");
-    fprintf(f, " \trankdir=LR;\n");
+// Right-aligned decimal in at least width columns
+static void ob_int(OutBuf *o, int v, int width) {
+    char tmp[12];
+    int n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) tmp[n++] = '-';
+    for (int k = n; k < width; ++k) ob_char(o, ' ');
+    while (n) ob_char(o, tmp[--n]);
+}
 
-    // 1. Define nodes: Trains (circles) and Resources (boxes)
-    for (int i = 0; i < s->ntrains; ++i) fprintf(f, " \tT%d [shape=circle,label=\"%s\"];\n", i, s->tname[i]);
-    for (int j = 0; j < s->ntracks; ++j) fprintf(f, " \tR%d [shape=box,label=\"%s\\n(av:%d)\"];\n", j, s->rname[j], s->available[j]);
-    
-    // 2. Add Resource Allocation Graph (RAG) edges
-    for (int i = 0; i < s->ntrains; ++i)
-        for (int j = 0; j < s->ntracks; ++j) {
-            // Allocation Edge: Resource -> Train (Solid line)
-            if (s->allocation[i][j] > 0) fprintf(f, " \tR%d -> T%d [label=\"%d\"];\n", j, i, s->allocation[i][j]);
-            // Request Edge: Train -> Resource (Dashed line)
-            if (s->need[i][j] > 0) fprintf(f, " \tT%d -> R%d [label=\"need:%d\", style=dashed];\n", i, j, s->need[i][j]);
-        }
-    
-    // 3. Add Wait-For Graph (WFG) edges (Red lines)
-    for (int i = 0; i < g->n; ++i)
-        for (int j = 0; j < g->n; ++j)
-            if (g->adj[i][j]) fprintf(f, " \tT%d -> T%d [color=red];\n", i, j);
-            
-    fprintf(f, "}\n");
-    fclose(f);
+static int digits(int v) {
+    int n = v < 0 ? 2 : 1;
+    for (v = v < 0 ? -v : v; v >= 10; v /= 10) ++n;
+    return n;
 }
 
-// --- Deadlock Recovery Functions ---
+static void ob_rule(OutBuf *o, int w) {
+    for (int i = 0; i < w; ++i) ob_char(o, '-');
+    ob_char(o, '\n');
+}
 
-// Simulates termination of a train, releasing its tracks
-static int terminate_train(RailwayState *s, int tid) {
-    if (tid < 0 || tid >= s->ntrains) return 0;
-    for (int j = 0; j < s->ntracks; ++j) {
-        s->available[j] += s->allocation[tid][j];
-        s->allocation[tid][j] = 0;
-        s->maximum[tid][j] = 0;
-        s->need[tid][j] = 0;
-    }
-    safe_strcpy(s->tname[tid], "(REMOVED)", MAX_NAME_LEN);
-    return 1;
+// Units a train still needs (which) or holds, over all tracks
+static int train_units(const railway_t *r, int tid, int (*which)(const railway_t *, int, int)) {
+    int sum = 0;
+    for (int j = 0; j < railway_ntracks(r); ++j) sum += which(r, tid, j);
+    return sum;
 }
 
-// Simulates preemption (taking tracks) from a train
-static int preempt_from_train(RailwayState *s, int tid, const int preempt[]) {
-    if (tid < 0 || tid >= s->ntrains) return 0;
-    for (int j = 0; j < s->ntracks; ++j) {
-        int take = preempt[j];
-        if (take < 0) take = 0;
-        // Ensure we don't take more than allocated
-        if (take > s->allocation[tid][j]) take = s->allocation[tid][j]; 
-        
-        s->allocation[tid][j] -= take;
-        s->available[j] += take;
+static int active_trains(const railway_t *r) {
+    int n = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) n += railway_train_active(r, i);
+    return n;
+}
+
+// What the active trains hold and still need on one track
+typedef struct {
+    int held, need;
+    int waiters;        // Trains with Need > 0 on the track
+} TrackTotals;
+
+static TrackTotals track_totals(const railway_t *r, int j) {
+    TrackTotals t = { 0, 0, 0 };
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_train_active(r, i)) continue;
+        int need = railway_need(r, i, j);
+        t.held += railway_allocation(r, i, j);
+        t.need += need;
+        t.waiters += need > 0;
     }
-    compute_need(s);
-    return 1;
+    return t;
 }
 
-// --- Display Functions ---
+// Need exceeds what is free, or some train is already waiting on it
+static int track_contended(const railway_t *r, const TrackTotals *t, int j) {
+    return t->need > railway_available(r, j) || t->waiters > 0;
+}
 
-static void print_horizontal(int w) {
-    for (int i = 0; i < w; ++i) putchar('-');
-    putchar('\n');
-}
-
-static void print_state(const RailwayState *s) {
-    printf("%s%sRAILWAY DEADLOCK SIMULATOR - RAIL MODE%s\n\n", C_BOLD, C_CYAN, C_RESET);
-    printf("%sTrains:%s %d    %sTrack Sections:%s %d\n\n", C_GREEN, C_RESET, s->ntrains, C_GREEN, C_RESET, s->ntracks);
-
-    // Dynamic width calculation for table (rough estimate)
-    int table_width = 20 + 3 * s->ntracks * 3 + 12; // Base + 3 columns * (spaces + 2 digits)
-
-    print_horizontal(table_width);
-    printf("%-4s %-12s |", "ID", "Train");
-    printf(" Alloc");
-    for (int j = 0; j < s->ntracks - 1; ++j) printf("   ");
-    printf(" | Max");
-    for (int j = 0; j < s->ntracks - 1; ++j) printf("   ");
-    printf(" | Need\n");
-    print_horizontal(table_width);
-
-    // Print column headers for resources/tracks
-    printf("%-4s %-12s |", "", "");
-    for (int j = 0; j < s->ntracks; ++j) printf(" R%d", j);
-    printf(" |");
-    for (int j = 0; j < s->ntracks; ++j) printf(" R%d", j);
-    printf(" |");
-    for (int j = 0; j < s->ntracks; ++j) printf(" R%d", j);
-    printf("\n");
-    print_horizontal(table_width);
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
 
+// What the state table shows: a page of the (filtered, sorted) trains against a
+// window of the (filtered) tracks
+typedef struct {
+    char sort;          // 'i' id, 'n' outstanding Need, 'h' units held, 'w' denials in a row
+    int need_only;      // Only trains that still need tracks
+    int contended_only; // Only contended tracks
+    int page, page_rows;
+    int track_from, track_cols;
+} StateView;
 
-    for (int i = 0; i < s->ntrains; ++i) {
-        printf("%3d  %-12s |", i, s->tname[i]);
-        for (int j = 0; j < s->ntracks; ++j) printf(" %2d", s->allocation[i][j]);
-        printf(" |");
-        for (int j = 0; j < s->ntracks; ++j) printf(" %2d", s->maximum[i][j]);
-        printf(" |");
-        for (int j = 0; j < s->ntracks; ++j) printf(" %2d", s->need[i][j]);
-        printf("\n");
+// Trains of the view in display order; returns their count
+static int view_trains(const railway_t *r, const StateView *v, int ids[]) {
+    long long key[MAX_TRAINS];
+    int n = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_train_active(r, i)) continue;
+        int need = train_units(r, i, railway_need);
+        if (v->need_only && !need) continue;
+        long long k = 0; // Larger values first, ties by id
+        if (v->sort == 'n') k = -(long long)need;
+        else if (v->sort == 'h') k = -(long long)train_units(r, i, railway_allocation);
+        else if (v->sort == 'w') k = -(long long)railway_denials(r, i, NULL, NULL);
+        key[n++] = k * MAX_TRAINS + i;
     }
-    print_horizontal(table_width);
-    printf("%sAvailable tracks:%s", C_MAGENTA, C_RESET);
-    for (int j = 0; j < s->ntracks; ++j) printf(" R%d=%d", j, s->available[j]);
-    printf("\n\n");
+    qsort(key, (size_t)n, sizeof(key[0]), cmp_ll);
+    for (int k = 0; k < n; ++k) ids[k] = (int)(((key[k] % MAX_TRAINS) + MAX_TRAINS) % MAX_TRAINS);
+    return n;
 }
 
-static void print_wfg(const WFG *g) {
-    printf("%sWait-For Graph (train -> train):%s\n", C_YELLOW, C_RESET);
-    for (int i = 0; i < g->n; ++i) {
-        printf("T%d (%s) waits for:", i, rail.tname[i]);
-        int any = 0;
-        for (int j = 0; j < g->n; ++j) if (g->adj[i][j]) { printf(" T%d (%s)", j, rail.tname[j]); any = 1; }
-        if (!any) printf(" none");
-        printf("\n");
+// Tracks passing the filter and the totals of every track; returns their count
+static int view_tracks(const railway_t *r, const StateView *v, int cols[], TrackTotals tot[]) {
+    int n = 0;
+    for (int j = 0; j < railway_ntracks(r); ++j) {
+        tot[j] = track_totals(r, j);
+        if (!v->contended_only || track_contended(r, &tot[j], j)) cols[n++] = j;
     }
-    printf("\n");
+    return n;
 }
 
-// --- Scenario Initialization Functions ---
+// Totals instead of matrices: what a large state looks like at a glance
+static void render_summary(OutBuf *o, const railway_t *r) {
+    TrackTotals tot[MAX_TRACKS];
+    int m = railway_ntracks(r), cap = 0, held = 0, need = 0, contended = 0, needing = 0, waiting = 0, nactive = 0;
+    for (int j = 0; j < m; ++j) {
+        tot[j] = track_totals(r, j);
+        cap += railway_capacity(r, j);
+        held += tot[j].held;
+        need += tot[j].need;
+        contended += track_contended(r, &tot[j], j);
+    }
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_train_active(r, i)) continue;
+        ++nactive;
+        needing += train_units(r, i, railway_need) > 0;
+        waiting += railway_denials(r, i, NULL, NULL) > 0;
+    }
+    ob_str(o, C_MAGENTA); ob_str(o, "Units (capacity/held/free/outstanding need):"); ob_str(o, C_RESET);
+    ob_char(o, ' '); ob_int(o, cap, 0); ob_char(o, '/'); ob_int(o, held, 0); ob_char(o, '/');
+    ob_int(o, cap - held, 0); ob_char(o, '/'); ob_int(o, need, 0);
+    ob_str(o, "  ("); ob_int(o, cap ? (int)(100LL * held / cap) : 0, 0); ob_str(o, "% held)\n");
+    ob_str(o, C_MAGENTA); ob_str(o, "Trains still needing tracks:"); ob_str(o, C_RESET);
+    ob_char(o, ' '); ob_int(o, needing, 0); ob_str(o, " of "); ob_int(o, nactive, 0);
+    ob_str(o, ", denied at least once in a row: "); ob_int(o, waiting, 0); ob_char(o, '\n');
+    ob_str(o, C_MAGENTA); ob_str(o, "Contended tracks:"); ob_str(o, C_RESET);
+    ob_char(o, ' '); ob_int(o, contended, 0); ob_str(o, " of "); ob_int(o, m, 0); ob_char(o, '\n');
 
-// Initializes a random, multi-unit scenario (best for testing non-binary values)
-static void fill_random_railway(RailwayState *s, int ntrains, int ntracks, int max_units_per_track) {
-    init_empty(s, ntrains, ntracks);
-    srand((unsigned)time(NULL));
+    // The tracks short by the most units and the trains still needing the most
+    long long key[MAX_TRACKS > MAX_TRAINS ? MAX_TRACKS : MAX_TRAINS];
+    int n = 0;
+    for (int j = 0; j < m; ++j)
+        if (track_contended(r, &tot[j], j)) key[n++] = -(long long)(tot[j].need - railway_available(r, j)) * MAX_TRACKS + j;
+    qsort(key, (size_t)n, sizeof(key[0]), cmp_ll);
+    for (int k = 0; k < n && k < SUMMARY_TOP; ++k) {
+        int j = (int)(((key[k] % MAX_TRACKS) + MAX_TRACKS) % MAX_TRACKS);
+        ob_str(o, "  "); ob_pad(o, railway_track_name(r, j), 12);
+        ob_str(o, " cap "); ob_int(o, railway_capacity(r, j), 3); ob_str(o, "  held "); ob_int(o, tot[j].held, 3);
+        ob_str(o, "  need "); ob_int(o, tot[j].need, 3); ob_str(o, "  waiters "); ob_int(o, tot[j].waiters, 2);
+        ob_char(o, '\n');
+    }
+    StateView top = { 'n', 1, 0, 0, SUMMARY_TOP, 0, 0 };
+    int ids[MAX_TRAINS];
+    n = view_trains(r, &top, ids);
+    if (n) { ob_str(o, C_MAGENTA); ob_str(o, "Largest outstanding Need:"); ob_str(o, C_RESET); }
+    for (int k = 0; k < n && k < SUMMARY_TOP; ++k) {
+        ob_char(o, ' '); ob_str(o, railway_train_name(r, ids[k])); ob_char(o, '=');
+        ob_int(o, train_units(r, ids[k], railway_need), 0);
+    }
+    if (n) ob_char(o, '\n');
+}
 
-    // 1. Set total available (Work pool is initialized later)
-    for (int j = 0; j < ntracks; ++j) s->available[j] = 1 + (rand() % max_units_per_track);
+// One page of the Alloc/Max/Need table plus the totals of the tracks shown.
+// The page and first track are clamped in place to what exists.
+static void render_table(OutBuf *o, const railway_t *r, StateView *v) {
+    int ids[MAX_TRAINS], cols[MAX_TRACKS];
+    TrackTotals tot[MAX_TRACKS];
+    int nt = view_trains(r, v, ids), nk = view_tracks(r, v, cols, tot);
+    int rows = v->page_rows > 0 ? v->page_rows : MAX_TRAINS;
+    int pages = nt ? (nt + rows - 1) / rows : 1;
+    if (v->page >= pages) v->page = pages - 1;
+    if (v->page < 0) v->page = 0;
+    if (v->track_from >= nk) v->track_from = nk - 1;
+    if (v->track_from < 0) v->track_from = 0;
+    int page = v->page, first = page * rows, last = first + rows < nt ? first + rows : nt;
+    int c0 = v->track_from;
+    int c1 = v->track_cols > 0 && c0 + v->track_cols < nk ? c0 + v->track_cols : nk;
 
-    // 2. Allocate resources randomly
-    for (int j = 0; j < ntracks; ++j) {
-        // A generous maximum capacity to ensure resources can be distributed
-        int cap = s->available[j] + ntrains * max_units_per_track; 
-        if (cap < 1) cap = 1;
-        
-        // Randomly decide how many resources in total will be allocated
-        int remaining = rand() % (cap + 1); 
-        
-        for (int i = 0; i < ntrains; ++i) {
-            int take = remaining ? (rand() % (remaining + 1)) : 0;
-            s->allocation[i][j] = take;
-            remaining -= take;
+    // One width for every cell, wide enough for the largest value and header shown
+    int w = 2;
+    for (int c = c0; c < c1; ++c) {
+        int j = cols[c];
+        if (digits(j) + 1 > w) w = digits(j) + 1;
+        for (int k = first; k < last; ++k) if (digits(railway_maximum(r, ids[k], j)) > w) w = digits(railway_maximum(r, ids[k], j));
+    }
+    int span = (c1 - c0) * (w + 1);
+    ob_rule(o, 17 + 3 * (span + 2));
+    ob_pad(o, "ID", 5); ob_pad(o, "Train", 12); ob_str(o, " |");
+    ob_pad(o, " Alloc", span); ob_str(o, " |"); ob_pad(o, " Max", span); ob_str(o, " |"); ob_str(o, " Need\n");
+    ob_pad(o, "", 17); ob_str(o, " |");
+    for (int x = 0; x < 3; ++x) {
+        for (int c = c0; c < c1; ++c) {
+            ob_char(o, ' ');
+            for (int k = digits(cols[c]) + 1; k < w; ++k) ob_char(o, ' ');
+            ob_char(o, 'R'); ob_int(o, cols[c], 0);
         }
+        ob_str(o, x < 2 ? " |" : "\n");
     }
-    
-    // 3. Recalculate Available (Total capacity = Allocated + Available)
-    for (int j = 0; j < ntracks; ++j) {
-        int total_alloc = 0;
-        for (int i = 0; i < ntrains; ++i) total_alloc += s->allocation[i][j];
-        // The previously set s->available[j] is now treated as initial available units.
-        int total_units = total_alloc + s->available[j]; 
-        if (total_units < 1) total_units = 1;
-        s->available[j] = total_units - total_alloc;
+    ob_rule(o, 17 + 3 * (span + 2));
+    int (*const cells[3])(const railway_t *, int, int) = { railway_allocation, railway_maximum, railway_need };
+    for (int k = first; k < last; ++k) {
+        int i = ids[k];
+        ob_int(o, i, 3); ob_str(o, "  "); ob_pad(o, railway_train_name(r, i), 12);
+        for (int x = 0; x < 3; ++x) {
+            ob_str(o, " |");
+            for (int c = c0; c < c1; ++c) { ob_char(o, ' '); ob_int(o, cells[x](r, i, cols[c]), w); }
+        }
+        ob_char(o, '\n');
+    }
+    ob_rule(o, 17 + 3 * (span + 2));
+    ob_str(o, C_MAGENTA); ob_str(o, "Available tracks:"); ob_str(o, C_RESET);
+    for (int c = c0; c < c1; ++c) { ob_str(o, " R"); ob_int(o, cols[c], 0); ob_char(o, '='); ob_int(o, railway_available(r, cols[c]), 0); }
+    ob_char(o, '\n');
+    ob_str(o, C_MAGENTA); ob_str(o, "Track totals (cap/held/need/waiters):"); ob_str(o, C_RESET);
+    for (int c = c0; c < c1; ++c) {
+        int j = cols[c];
+        ob_str(o, " R"); ob_int(o, j, 0); ob_char(o, '=');
+        ob_int(o, railway_capacity(r, j), 0); ob_char(o, '/'); ob_int(o, tot[j].held, 0); ob_char(o, '/');
+        ob_int(o, tot[j].need, 0); ob_char(o, '/'); ob_int(o, tot[j].waiters, 0);
+    }
+    ob_char(o, '\n');
+    if (nt > last - first || nk > c1 - c0) {
+        ob_str(o, "Trains "); ob_int(o, nt ? first + 1 : 0, 0); ob_char(o, '-'); ob_int(o, last, 0);
+        ob_str(o, " of "); ob_int(o, nt, 0); ob_str(o, " (page "); ob_int(o, page + 1, 0); ob_char(o, '/');
+        ob_int(o, pages, 0); ob_str(o, "), tracks "); ob_int(o, nk ? c0 + 1 : 0, 0); ob_char(o, '-');
+        ob_int(o, c1, 0); ob_str(o, " of "); ob_int(o, nk, 0); ob_char(o, '\n');
     }
-
-    // 4. Set Maximum (Allocation + random Need)
-    for (int i = 0; i < ntrains; ++i)
-        for (int j = 0; j < ntracks; ++j)
-            s->maximum[i][j] = s->allocation[i][j] + (rand() % (max_units_per_track + 1));
-            
-    compute_need(s);
 }
 
-// Initializes a specific non-deadlocked sample scenario (mostly binary)
-static void sample_railway(RailwayState *s) {
-    init_empty(s, 5, 5);
-    safe_strcpy(s->tname[0], "A", MAX_NAME_LEN);
-    safe_strcpy(s->tname[1], "B", MAX_NAME_LEN);
-    safe_strcpy(s->tname[2], "C", MAX_NAME_LEN);
-    safe_strcpy(s->tname[3], "D", MAX_NAME_LEN);
-    safe_strcpy(s->tname[4], "E", MAX_NAME_LEN);
-    safe_strcpy(s->rname[0], "T0", MAX_NAME_LEN);
-    safe_strcpy(s->rname[1], "T1", MAX_NAME_LEN);
-    safe_strcpy(s->rname[2], "T2", MAX_NAME_LEN);
-    safe_strcpy(s->rname[3], "T3", MAX_NAME_LEN);
-    safe_strcpy(s->rname[4], "T4", MAX_NAME_LEN);
+static void render_header(OutBuf *o, const railway_t *r) {
+    int nactive = active_trains(r), removed = railway_ntrains(r) - nactive;
+    ob_str(o, C_BOLD); ob_str(o, C_CYAN); ob_str(o, "RAILWAY DEADLOCK SIMULATOR - RAIL MODE"); ob_str(o, C_RESET); ob_str(o, "\n\n");
+    ob_str(o, C_GREEN); ob_str(o, "Trains:"); ob_str(o, C_RESET); ob_char(o, ' '); ob_int(o, nactive, 0);
+    ob_str(o, "    "); ob_str(o, C_GREEN); ob_str(o, "Track Sections:"); ob_str(o, C_RESET); ob_char(o, ' '); ob_int(o, railway_ntracks(r), 0);
+    if (removed) {
+        ob_str(o, "    "); ob_str(o, C_GREEN); ob_str(o, "Removed slots:"); ob_str(o, C_RESET); ob_char(o, ' '); ob_int(o, removed, 0);
+    }
+    ob_str(o, "\n\n");
+}
 
-    // Available Resources (Tracks)
-    s->available[0] = 1;
-    s->available[1] = 1;
-    s->available[2] = 0;
-    s->available[3] = 1;
-    s->available[4] = 0;
+// Full tables for small states; totals and the first page for large ones
+static void print_state(const railway_t *r) {
+    OutBuf o;
+    o.len = 0;
+    render_header(&o, r);
+    if (active_trains(r) <= STATE_PAGE_ROWS && railway_ntracks(r) <= STATE_PAGE_TRACKS) {
+        StateView all = { 'i', 0, 0, 0, 0, 0, 0 };
+        render_table(&o, r, &all);
+    } else {
+        render_summary(&o, r);
+        ob_char(&o, '\n');
+        StateView first = { 'n', 0, 0, 0, STATE_PAGE_ROWS, 0, STATE_PAGE_TRACKS };
+        render_table(&o, r, &first);
+        ob_str(&o, "Browse the rest with menu 28.\n");
+    }
+    ob_char(&o, '\n');
+    ob_flush(&o);
+}
 
-    // Maximum Demand Matrix M
-    int M[5][5] = {
-        {1,1,1,0,0},
-        {0,1,0,1,0},
-        {0,0,1,0,1},
-        {0,1,0,1,0},
-        {1,0,0,0,1}
-    };
-    // Allocation Matrix A
-    int A[5][5] = {
-        {0,0,0,0,0},
-        {0,1,0,0,0},
-        {0,0,1,0,0},
-        {0,0,0,0,0},
-        {1,0,0,0,0}
-    };
-    
-    for (int i = 0; i < 5; ++i)
-        for (int j = 0; j < 5; ++j) {
-            s->maximum[i][j] = M[i][j];
-            s->allocation[i][j] = A[i][j];
-        }
-    compute_need(s);
+static void print_wfg(const railway_t *r, const unsigned long waits[]) {
+    printf("%sWait-For Graph (train -> train):%s\n", C_YELLOW, C_RESET);
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_train_active(r, i)) continue;
+        printf("T%d (%s) waits for:", i, railway_train_name(r, i));
+        if (!waits[i]) printf(" none");
+        for (int j = 0; j < railway_ntrains(r); ++j)
+            if (waits[i] >> j & 1ul) printf(" T%d (%s)", j, railway_train_name(r, j));
+        printf("\n");
+    }
+    printf("\n");
 }
 
 // Interactive manual input for a custom scenario
-static void manual_railway(RailwayState *s) {
+static int manual_railway(railway_t *r) {
     int ntr, ntrks;
     printf("Enter number of trains (1-%d): ", MAX_TRAINS);
-    if (scanf("%d", &ntr) != 1) { while(getchar()!='\n'); return; }
+    if (scanf("%d", &ntr) != 1) { while(getchar()!='\n'); return -1; }
     printf("Enter number of track sections (1-%d): ", MAX_TRACKS);
-    if (scanf("%d", &ntrks) != 1) { while(getchar()!='\n'); return; }
-    if (ntr < 1 || ntr > MAX_TRAINS || ntrks < 1 || ntrks > MAX_TRACKS) { printf("Invalid sizes\n"); return; }
-    init_empty(s, ntr, ntrks);
-    
+    if (scanf("%d", &ntrks) != 1) { while(getchar()!='\n'); return -1; }
+    if (ntr < 1 || ntr > MAX_TRAINS || ntrks < 1 || ntrks > MAX_TRACKS) { printf("Invalid sizes\n"); return -1; }
+
+    static int avail[MAX_TRACKS], alloc[MAX_TRAINS * MAX_TRACKS], max[MAX_TRAINS * MAX_TRACKS];
+    static char names[MAX_TRAINS][64];   // Truncated by the name table
     for (int j = 0; j < ntrks; ++j) {
         printf("Total available units for Track %d: ", j);
-        if (scanf("%d", &s->available[j]) != 1) { while(getchar()!='\n'); return; }
-        snprintf(s->rname[j], MAX_NAME_LEN, "Trk%02d", j);
+        if (scanf("%d", &avail[j]) != 1) { while(getchar()!='\n'); return -1; }
     }
-    
+
     for (int i = 0; i < ntr; ++i) {
         char tmp[64];
         printf("Train name for T%d: ", i);
         getchar(); // consume leftover newline
-        if (fgets(tmp, sizeof(tmp), stdin)) {
-            tmp[strcspn(tmp, "\n")] = 0;
-            if (tmp[0]) safe_strcpy(s->tname[i], tmp, MAX_NAME_LEN);
-            else snprintf(s->tname[i], MAX_NAME_LEN, "Train%d", i);
-        }
+        if (!fgets(tmp, sizeof(tmp), stdin)) tmp[0] = 0;
+        tmp[strcspn(tmp, "\n")] = 0;
+        if (tmp[0]) memcpy(names[i], tmp, sizeof(tmp));
+        else snprintf(names[i], sizeof(names[i]), "Train%d", i);
 
         for (int j = 0; j < ntrks; ++j) {
-            printf("Allocation of Track %d for %s: ", j, s->tname[i]);
-            if (scanf("%d", &s->allocation[i][j]) != 1) { while(getchar()!='\n'); return; }
-            printf("Maximum demand of Track %d for %s: ", j, s->tname[i]);
-            if (scanf("%d", &s->maximum[i][j]) != 1) { while(getchar()!='\n'); return; }
-            if (s->allocation[i][j] > s->maximum[i][j]) s->maximum[i][j] = s->allocation[i][j];
+            int *a = &alloc[i * ntrks + j], *m = &max[i * ntrks + j];
+            printf("Allocation of Track %d for %s: ", j, names[i]);
+            if (scanf("%d", a) != 1) { while(getchar()!='\n'); return -1; }
+            printf("Maximum demand of Track %d for %s: ", j, names[i]);
+            if (scanf("%d", m) != 1) { while(getchar()!='\n'); return -1; }
+            if (*a > *m) *m = *a;
         }
     }
-    compute_need(s);
+    if (railway_load(r, ntr, ntrks, avail, alloc, max)) { printf("Invalid units (all must be >= 0)\n"); return -1; }
+    for (int j = 0; j < ntrks; ++j) {
+        char buf[MAX_NAME_LEN];
+        snprintf(buf, sizeof(buf), "Trk%02d", j);
+        railway_set_track_name(r, j, buf);
+    }
+    for (int i = 0; i < ntr; ++i) railway_set_train_name(r, i, names[i]);
+    return 0;
 }
 
 // --- Menu Handlers ---
 
-static void handle_bankers(RailwayState *s) {
+// The menu has nobody to report to: running out of working memory ends it
+static void *menu_alloc(size_t bytes) {
+    void *p = malloc(bytes);
+    if (!p) die("out of memory");
+    return p;
+}
+
+// Reads a train given either by id or by name; unknown names yield -1
+static int read_train(const railway_t *r, const char *prompt, int *tid) {
+    char tok[64];
+    printf("%s", prompt);
+    if (scanf("%63s", tok) != 1) { while(getchar()!='\n'); return 0; }
+    char *end;
+    long v = strtol(tok, &end, 10);
+    *tid = (*end == '\0') ? (int)v : railway_find_train(r, tok);
+    return 1;
+}
+
+static void handle_bankers(railway_t *r) {
     int tid;
-    printf("Enter train id requesting track(s) (0-%d): ", s->ntrains-1);
-    if (scanf("%d", &tid) != 1) { while(getchar()!='\n'); return; }
+    char prompt[64];
+    snprintf(prompt, sizeof(prompt), "Enter train id (0-%d) or name requesting track(s): ", railway_ntrains(r)-1);
+    if (!read_train(r, prompt, &tid)) return;
 
     int req[MAX_TRACKS] = {0};
-    for (int j = 0; j < s->ntracks; ++j) {
+    for (int j = 0; j < railway_ntracks(r); ++j) {
         printf("Request units of Track %d: ", j);
         if (scanf("%d", &req[j]) != 1) { while(getchar()!='\n'); return; }
     }
 
-    save_checkpoint(s, "pre-bankers");
-    int ok = bankers_request(s, tid, req);
-    if (ok) printf("%sRequest granted safely.%s\n", C_GREEN, C_RESET);
-    else printf("%sRequest denied (unsafe or invalid).%s\n", C_RED, C_RESET);
+    railway_checkpoint_save(r, "pre-bankers");
+    int ok = railway_request(r, tid, req);
+    if (ok > 0) { printf("%sRequest granted safely.%s\n", C_GREEN, C_RESET); return; }
+    if (ok < 0) { printf("%sInvalid request (unknown train or beyond its Need).%s\n", C_RED, C_RESET); return; }
+    printf("%sRequest denied (unsafe or must wait).%s\n", C_RED, C_RESET);
+
+    int wait;
+    printf("Wait for it with a deadline in ticks (0 = discard): ");
+    if (scanf("%d", &wait) != 1) { while(getchar()!='\n'); return; }
+    if (wait <= 0) return;
+    if (railway_queue_request(r, tid, req, (unsigned)wait) == 0) printf("Queued; retried in %d tick(s).\n", wait);
+    else printf("%sCannot queue the request.%s\n", C_RED, C_RESET);
 }
 
-static void handle_detect(RailwayState *s) {
-    WFG g;
-    build_wfg(s, &g);
-    print_wfg(&g);
+static void handle_capacity(railway_t *r) {
+    int j, cap, taken[MAX_TRAINS];
+    printf("Track (0-%d) and its new capacity: ", railway_ntracks(r) - 1);
+    if (scanf("%d %d", &j, &cap) != 2) { while(getchar()!='\n'); return; }
+    if (j >= 0 && j < railway_ntracks(r)) printf("%s: capacity %d -> %d\n", railway_track_name(r, j), railway_capacity(r, j), cap);
+    int safe = railway_set_capacity(r, j, cap, taken);
+    if (safe < 0) { printf("%sInvalid track or capacity.%s\n", C_RED, C_RESET); return; }
+    for (int i = 0; i < railway_ntrains(r); ++i)
+        if (taken[i]) printf("  Preempted %d unit(s) from %s\n", taken[i], railway_train_name(r, i));
+    if (safe) printf("%sSystem remains in a SAFE state.%s\n", C_GREEN, C_RESET);
+    else printf("%sSystem is now UNSAFE: plan recovery (menus 7/8).%s\n", C_RED, C_RESET);
+}
 
-    int cycle[MAX_TRAINS];
-    int clen = 0;
-    int found = detect_cycle_wfg(&g, cycle, &clen);
-    
-    if (found) {
-        printf("%sDeadlock detected! Cycle:%s ", C_RED, C_RESET);
-        // Print cycle in reverse order as DFS records it from tail to head
-        for (int i = clen-1; i >= 0; --i) {
-            printf("%s", s->tname[cycle[i]]);
-            if (i > 0) printf(" -> ");
-        }
-        printf("\n");
-    } else {
-        printf("%sNo deadlock detected by WFG (or system is in a safe/avoidable state).%s\n", C_GREEN, C_RESET);
+static void handle_admit(railway_t *r) {
+    char name[64];
+    int max[MAX_TRACKS];
+    printf("Name of the new train (- for default): ");
+    if (scanf("%63s", name) != 1) { while(getchar()!='\n'); return; }
+    for (int j = 0; j < railway_ntracks(r); ++j) {
+        printf("Maximum demand of %s (capacity %d): ", railway_track_name(r, j), railway_capacity(r, j));
+        if (scanf("%d", &max[j]) != 1) { while(getchar()!='\n'); return; }
     }
-    
+    int tid = railway_admit(r, max, strcmp(name, "-") ? name : NULL);
+    if (tid < 0) printf("%sAdmission refused: the claim is invalid, exceeds capacity or would leave the system unsafe.%s\n", C_RED, C_RESET);
+    else printf("%sAdmitted %s as train %d.%s\n", C_GREEN, railway_train_name(r, tid), tid, C_RESET);
+}
+
+static void handle_retire(railway_t *r) {
+    int tid;
+    if (!read_train(r, "Enter completed train id or name to retire: ", &tid)) return;
+    if (railway_retire(r, tid) == 0) printf("%sTrain %d retired and tracks released.%s\n", C_YELLOW, tid, C_RESET);
+    else printf("%sRetirement failed (invalid id or train still has Need).%s\n", C_RED, C_RESET);
+}
+
+static void handle_revise(railway_t *r) {
+    int tid, max[MAX_TRACKS];
+    if (!read_train(r, "Enter rerouted train id or name: ", &tid)) return;
+    if (!railway_train_active(r, tid)) { printf("%sInvalid train ID.%s\n", C_RED, C_RESET); return; }
+    for (int j = 0; j < railway_ntracks(r); ++j) {
+        printf("New maximum demand of %s on %s (holds %d, was %d): ", railway_train_name(r, tid), railway_track_name(r, j),
+               railway_allocation(r, tid, j), railway_maximum(r, tid, j));
+        if (scanf("%d", &max[j]) != 1) { while(getchar()!='\n'); return; }
+    }
+    int rc = railway_revise_claim(r, tid, max);
+    if (rc > 0) { printf("%sClaim revised; the system stays SAFE.%s\n", C_GREEN, C_RESET); return; }
+    if (rc < 0) { printf("%sInvalid claim (below the allocation or above capacity).%s\n", C_RED, C_RESET); return; }
+    char ans[8];
+    printf("%sRevision rejected: it would leave the system UNSAFE.%s Defer it until the clock advances? (y/n): ", C_RED, C_RESET);
+    if (scanf("%7s", ans) != 1 || (ans[0] != 'y' && ans[0] != 'Y')) return;
+    if (railway_defer_claim(r, tid, max) == 0) printf("Deferred.\n");
+    else printf("%sCannot defer the claim.%s\n", C_RED, C_RESET);
+}
+
+static void handle_event_log(railway_t *r) {
+    if (railway_log_is_open(r)) {
+        long dropped = 0;
+        long written = railway_log_close(r, &dropped);
+        printf("Event log closed: %ld record(s) written, %ld dropped.\n", written, dropped);
+        return;
+    }
+    char fname[128], mode[8];
+    printf("Log file and format (text/raw): ");
+    if (scanf("%127s %7s", fname, mode) != 2) { while(getchar()!='\n'); return; }
+    if (railway_log_open(r, fname, mode[0] == 'r') == 0) printf("%sLogging every decision to %s.%s\n", C_GREEN, fname, C_RESET);
+    else printf("%sCannot open %s.%s\n", C_RED, fname, C_RESET);
+}
+
+static void handle_starvation_limits(railway_t *r) {
+    int streak, now_streak;
+    unsigned now_wait;
+    int wait;
+    railway_starvation_limits(r, &now_streak, &now_wait);
+    printf("Starving after N denials in a row (now %d): ", now_streak);
+    if (scanf("%d", &streak) != 1) { while(getchar()!='\n'); return; }
+    printf("Starving after T ticks of denials (now %u): ", now_wait);
+    if (scanf("%d", &wait) != 1) { while(getchar()!='\n'); return; }
+    if (wait < 1 || railway_set_starvation_limits(r, streak, (unsigned)wait)) printf("Invalid limits\n");
+}
+
+static void handle_clock(railway_t *r) {
+    int ticks;
+    printf("Tick %u, %d request(s) pending. Advance by how many ticks: ", railway_clock(r), railway_pending(r));
+    if (scanf("%d", &ticks) != 1 || ticks < 0) { while(getchar()!='\n'); return; }
+    railway_clock_stats_t st;
+    if (railway_advance_clock(r, (unsigned)ticks, &st) < 0) { printf("%sOut of working memory.%s\n", C_RED, C_RESET); return; }
+    printf("Now tick %u: %ld retried, %ld granted, %ld re-queued with a boost, %ld escalated, %ld dropped\n",
+           railway_clock(r), st.retried, st.granted, st.boosted, st.escalated, st.dropped);
+    if (st.revised) printf("%ld deferred claim revision(s) applied\n", st.revised);
+    int any = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_needs_recovery(r, i)) continue;
+        if (!any++) printf("%sNeed recovery (requests timed out after %d boosts):%s", C_YELLOW, PENDING_MAX_BOOSTS, C_RESET);
+        printf(" %s", railway_train_name(r, i));
+    }
+    if (any) printf("\n");
+}
+
+// Prints a cycle in wait order, closing it back on its first train
+static void print_cycle(const railway_t *r, const int cycle[], int len) {
+    printf("%sDeadlock detected! Cycle:%s ", C_RED, C_RESET);
+    for (int k = 0; k < len; ++k) printf("%s -> ", railway_train_name(r, cycle[k]));
+    printf("%s\n", railway_train_name(r, cycle[0]));
+}
+
+static void handle_detect(railway_t *r) {
+    unsigned long waits[MAX_TRAINS];
+    if (railway_wait_graph(r, waits) < 0) { printf("%sOut of working memory.%s\n", C_RED, C_RESET); return; }
+    print_wfg(r, waits);
+
+    int cycle[MAX_TRAINS], clen = 0;
+    int found = railway_detect(r, cycle, &clen);
+    if (found < 0) { printf("%sOut of working memory.%s\n", C_RED, C_RESET); return; }
+    if (found) print_cycle(r, cycle, clen);
+    else printf("%sNo deadlock detected by WFG (or system is in a safe/avoidable state).%s\n", C_GREEN, C_RESET);
+
     // Also run safety check for completeness, even if WFG didn't find a cycle.
     int seq[MAX_TRAINS];
-    if (safety_check(s, seq)) {
+    int rounds = railway_safety_rounds(r, seq);
+    if (rounds >= 0) {
         printf("%sSystem is in a SAFE state (Banker's Check).%s\n", C_GREEN, C_RESET);
+        printf("Safe sequence:");
+        for (int i = 0, k = 0; i < railway_ntrains(r); ++i)
+            if (railway_train_active(r, i)) printf(" %s", railway_train_name(r, seq[k++]));
+        printf("  (dependency depth: %d rounds)\n", rounds);
     } else {
         printf("%sSystem is in an UNSAFE state (Banker's Check).%s\n", C_RED, C_RESET);
     }
+    printf("Independent components: %d\n", railway_components(r));
+
+    // Starvation and livelock: trains denied past the limits without a cycle
+    int starving = 0, waiting = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_train_active(r, i)) continue;
+        int worst;
+        unsigned since;
+        int streak = railway_denials(r, i, &worst, &since);
+        waiting += streak > 0;
+        if (!railway_starving(r, i)) continue;
+        if (!starving++) printf("%sStarving trains:%s\n", C_YELLOW, C_RESET);
+        printf("  %s: denied %d times in a row over %u ticks (worst streak %d)\n", railway_train_name(r, i),
+               streak, railway_clock(r) - since, worst);
+    }
+    if (!starving) printf("%sNo starving trains.%s\n", C_GREEN, C_RESET);
+    else if (!found && starving == waiting)
+        printf("%sLivelock: every waiting train is starving and no cycle explains it.%s\n", C_RED, C_RESET);
 }
 
-static void handle_terminate(RailwayState *s) {
+static void handle_terminate(railway_t *r) {
     int tid;
-    printf("Enter train id to terminate: ");
-    if (scanf("%d", &tid) != 1) { while(getchar()!='\n'); return; }
+    if (!read_train(r, "Enter train id or name to terminate: ", &tid)) return;
 
-    save_checkpoint(s, "pre-terminate");
-    if (terminate_train(s, tid)) printf("%sTrain %d terminated and tracks released.%s\n", C_YELLOW, tid, C_RESET);
+    railway_checkpoint_save(r, "pre-terminate");
+    if (railway_terminate(r, tid) == 0) printf("%sTrain %d terminated and tracks released.%s\n", C_YELLOW, tid, C_RESET);
     else printf("%sTermination failed (invalid id).%s\n", C_RED, C_RESET);
 }
 
-static void handle_preempt(RailwayState *s) {
+static void handle_preempt(railway_t *r) {
     int tid;
-    printf("Enter victim train id for preemption: ");
-    if (scanf("%d", &tid) != 1) { while(getchar()!='\n'); return; }
+    if (!read_train(r, "Enter victim train id or name for preemption: ", &tid)) return;
 
-    if (tid < 0 || tid >= s->ntrains) { printf("%sInvalid train ID.%s\n", C_RED, C_RESET); return; }
+    if (!railway_train_active(r, tid)) { printf("%sInvalid train ID.%s\n", C_RED, C_RESET); return; }
 
     int pre[MAX_TRACKS];
-    for (int j = 0; j < s->ntracks; ++j) {
-        printf("Units to preempt from Track %d (0..%d): ", j, s->allocation[tid][j]);
+    for (int j = 0; j < railway_ntracks(r); ++j) {
+        printf("Units to preempt from Track %d (0..%d): ", j, railway_allocation(r, tid, j));
         if (scanf("%d", &pre[j]) != 1) { while(getchar()!='\n'); return; }
     }
     
-    save_checkpoint(s, "pre-preempt");
-    if (preempt_from_train(s, tid, pre)) printf("%sPreemption done from train %d.%s\n", C_YELLOW, tid, C_RESET);
+    railway_checkpoint_save(r, "pre-preempt");
+    if (railway_release(r, tid, pre) == 0) printf("%sPreemption done from train %d.%s\n", C_YELLOW, tid, C_RESET);
     else printf("%sPreemption failed.%s\n", C_RED, C_RESET);
 }
 
-static void handle_save_cp(RailwayState *s) {
+static void handle_save_cp(railway_t *r) {
     char note[128];
     printf("Note for checkpoint: ");
     getchar(); // consume leftover newline
     if (!fgets(note, sizeof(note), stdin)) note[0] = 0;
     note[strcspn(note, "\n")] = 0;
 
-    int idx = save_checkpoint(s, note);
-    if (idx >= 0) printf("%sSaved checkpoint %d (%s).%s\n", C_GREEN, idx, checkpoints[idx].note, C_RESET);
+    int idx = railway_checkpoint_save(r, note);
+    if (idx >= 0) printf("%sSaved checkpoint %d (%s).%s\n", C_GREEN, idx, railway_checkpoint_note(r, idx), C_RESET);
     else printf("%sNo free checkpoint slots.%s\n", C_RED, C_RESET);
 }
 
-static void handle_restore_cp(RailwayState *s) {
+static void handle_restore_cp(railway_t *r) {
     int idx;
     printf("Available Checkpoints:\n");
     for (int i = 0; i < MAX_CHECKPOINTS; ++i) {
-        if (checkpoints[i].valid) {
-            printf("  %d: %s\n", i, checkpoints[i].note);
-        }
+        const char *note = railway_checkpoint_note(r, i);
+        if (note) printf("  %d: %s\n", i, note);
     }
     printf("Enter checkpoint index to restore (0-%d): ", MAX_CHECKPOINTS-1);
     if (scanf("%d", &idx) != 1) { while(getchar()!='\n'); return; }
 
-    if (restore_checkpoint(s, idx) == 0) printf("%sRestored checkpoint %d.%s\n", C_GREEN, idx, C_RESET);
+    if (railway_checkpoint_restore(r, idx) == 0) printf("%sRestored checkpoint %d.%s\n", C_GREEN, idx, C_RESET);
     else printf("%sRestore failed (invalid or unused index).%s\n", C_RED, C_RESET);
 }
 
-static void handle_export(RailwayState *s) {
-    WFG g;
-    build_wfg(s, &g);
+static void handle_export(railway_t *r) {
     char fname[128];
     printf("Enter filename for DOT export (e.g., railway.dot): ");
     if (scanf("%s", fname) != 1) { while(getchar()!='\n'); return; }
-    export_dot(s, &g, fname);
+
+    if (railway_export_dot(r, fname) != 0) {
+        printf("%sCannot write %s: %s%s\n", C_RED, fname, strerror(errno), C_RESET);
+        return;
+    }
     printf("%sDOT exported to %s. Use 'dot -Tpng %s -o out.png' (Graphviz) to render.%s\n", C_CYAN, fname, fname, C_RESET);
 }
 
+// Pages through the state table, trains sorted and filtered, a window of tracks at a time
+static void handle_browse_state(railway_t *r) {
+    StateView v = { 'i', 0, 0, 0, STATE_PAGE_ROWS, 0, STATE_PAGE_TRACKS };
+    char cmd[8];
+    printf("Sort trains by (i=id n=need h=held w=denials in a row): ");
+    if (scanf("%7s", cmd) != 1) { while(getchar()!='\n'); return; }
+    v.sort = cmd[0];
+    printf("Only trains with Need > 0, only contended tracks (0/1 0/1): ");
+    if (scanf("%d %d", &v.need_only, &v.contended_only) != 2) { while(getchar()!='\n'); return; }
+    printf("Trains and tracks per page (e.g., %d %d): ", STATE_PAGE_ROWS, STATE_PAGE_TRACKS);
+    if (scanf("%d %d", &v.page_rows, &v.track_cols) != 2) { while(getchar()!='\n'); return; }
+    if (v.page_rows < 1 || v.track_cols < 1) { printf("%sInvalid page size.%s\n", C_RED, C_RESET); return; }
+
+    OutBuf o;
+    o.len = 0;
+    for (;;) {
+        render_table(&o, r, &v);
+        ob_flush(&o);
+        printf("n/p = next/previous trains, >/< = next/previous tracks, q = done: ");
+        if (scanf("%7s", cmd) != 1 || cmd[0] == 'q') break;
+        if (cmd[0] == 'n') v.page++;
+        else if (cmd[0] == 'p') v.page--;
+        else if (cmd[0] == '>') v.track_from += v.track_cols;
+        else if (cmd[0] == '<') v.track_from -= v.track_cols;
+    }
+}
+
+// Times the generic row loops against the kernels selected for this scenario
+static void handle_benchmark(railway_t *r) {
+    int iters;
+    printf("Iterations per kernel (e.g., 100000): ");
+    if (scanf("%d", &iters) != 1 || iters < 1) { while(getchar()!='\n'); return; }
+    int ntrains = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) ntrains += railway_train_active(r, i);
+    if (!ntrains) { printf("No active trains.\n"); return; }
+
+    KernelBench b;
+    long lost0 = 0, lost1 = 0;
+    int logging = railway_log_stats(r, NULL, &lost0) == 0;
+    if (benchmark_kernels(r, iters, &b)) die("out of memory");
+    printf("%sKernel benchmark (%d trains x %d tracks, %d-byte cells)%s\n", C_BOLD, ntrains, railway_ntracks(r), b.cell_width, C_RESET);
+    for (int k = 0; k < 3; ++k)
+        printf("  %-12s safety %8.1f ns   wfg %8.1f ns   row_le %6.1f ns\n", b.name[k], b.safety[k], b.wfg[k], b.row_le[k]);
+    printf("  compressed   safety %8.1f ns   (%d x %d -> %d classes x %d tracks%s)\n", b.compressed,
+           ntrains, railway_ntracks(r), b.classes, b.class_tracks, b.classes ? "" : ", kernel used");
+    printf("  Need upkeep  full recompute %8.1f ns   incremental row (release+regrant) %8.1f ns\n", b.need_full, b.need_row);
+    if (logging) {
+        railway_log_stats(r, NULL, &lost1);
+        printf("  event log    %8.1f ns per record   (%ld of %d dropped by a full ring)\n", b.log_record, lost1 - lost0, iters);
+    }
+}
+
+// What the stress producers draw their workload from, read-only while they run
+typedef struct {
+    int ntracks, nactive;
+    int active[MAX_TRAINS];
+    int need[MAX_TRAINS][MAX_TRACKS];
+} StressWorkload;
+
+// One producer of the admission stress test: alternately requests a unit of a
+// claimed track and releases one it was granted, timing every round trip
+typedef struct {
+    int p, nprod, ops, locked;
+    const StressWorkload *work;
+    pthread_mutex_t *lock;
+    railway_t *shared;               // Called under lock, or through its admission thread
+    long long *lat;
+    long granted;
+} StressProducer;
+
+// The call a RAILWAY_SUBMIT_* kind stands for
+static int call_mutation(railway_t *r, int kind, int tid, const int units[]) {
+    if (kind == RAILWAY_SUBMIT_REQUEST) return railway_request(r, tid, units);
+    if (kind == RAILWAY_SUBMIT_RELEASE) return railway_release(r, tid, units);
+    return railway_revise_claim(r, tid, units);
+}
+
+static void *stress_producer(void *arg) {
+    StressProducer *sp = arg;
+    const StressWorkload *w = sp->work;
+    int held[MAX_TRAINS][MAX_TRACKS] = {{0}};
+    int units[MAX_TRACKS] = {0};
+    unsigned seed = 2654435761u * (unsigned)(sp->p + 1);
+    for (int k = 0; k < sp->ops; ++k) {
+        seed = seed * 1103515245u + 12345u;
+        int tid = w->active[(sp->p + (int)(seed >> 8) * sp->nprod) % w->nactive];
+        int j = (int)((seed >> 16) % (unsigned)w->ntracks);
+        int kind = held[tid][j] ? RAILWAY_SUBMIT_RELEASE : RAILWAY_SUBMIT_REQUEST;
+        if (kind == RAILWAY_SUBMIT_REQUEST && !w->need[tid][j]) continue;
+        units[j] = 1;
+        long long t0 = now_ns();
+        int r;
+        if (sp->locked) {
+            pthread_mutex_lock(sp->lock);
+            r = call_mutation(sp->shared, kind, tid, units);
+            pthread_mutex_unlock(sp->lock);
+        } else r = railway_submit(sp->shared, sp->p, kind, tid, units);
+        sp->lat[k] = now_ns() - t0;
+        units[j] = 0;
+        if (kind == RAILWAY_SUBMIT_REQUEST && r == 1) { ++held[tid][j]; ++sp->granted; }
+        else if (kind == RAILWAY_SUBMIT_RELEASE) held[tid][j] = 0;
+    }
+    return NULL;
+}
+
+// Runs the stress workload with nprod producers, either through the admission
+// thread or under one mutex, on a clone of r. Prints throughput and latency.
+static void stress_admission(const railway_t *r, const StressWorkload *w, int nprod, int ops, int locked) {
+    long long *lat = menu_alloc(sizeof(long long) * (size_t)nprod * (size_t)ops);
+    StressProducer sp[MAX_PRODUCERS];
+    pthread_t th[MAX_PRODUCERS];
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    railway_t *copy = railway_clone(r);
+    if (!copy) die("out of memory");
+    for (size_t k = 0; k < (size_t)nprod * (size_t)ops; ++k) lat[k] = -1;
+    if (!locked && railway_admission_start(copy)) {
+        printf("%sCannot start the admission thread.%s\n", C_RED, C_RESET);
+        railway_destroy(copy);
+        free(lat);
+        return;
+    }
+
+    long long t0 = now_ns();
+    for (int p = 0; p < nprod; ++p) {
+        sp[p] = (StressProducer){ p, nprod, ops, locked, w, &lock, copy, lat + (size_t)p * (size_t)ops, 0 };
+        pthread_create(&th[p], NULL, stress_producer, &sp[p]);
+    }
+    long granted = 0;
+    for (int p = 0; p < nprod; ++p) { pthread_join(th[p], NULL); granted += sp[p].granted; }
+    long long t1 = now_ns();
+    long batches = locked ? 0 : railway_admission_stop(copy);
+    railway_destroy(copy);
+
+    size_t n = 0;
+    for (size_t k = 0; k < (size_t)nprod * (size_t)ops; ++k) if (lat[k] >= 0) lat[n++] = lat[k];
+    qsort(lat, n, sizeof(long long), cmp_ll);
+    printf("  %-15s %9.0f ops/s   p50 %7lld ns   p99 %8lld ns   max %9lld ns   (%ld granted",
+           locked ? "mutex" : "admission ring", n ? (double)n * 1e9 / (double)(t1 - t0) : 0.0,
+           n ? lat[n / 2] : 0, n ? lat[n * 99 / 100] : 0, n ? lat[n - 1] : 0, granted);
+    if (batches > 0) printf(", %.1f per batch", (double)n / (double)batches);
+    printf(")\n");
+    free(lat);
+}
+
+static void handle_admission_stress(railway_t *r) {
+    int nprod, ops;
+    printf("Producer threads (1-%d) and operations per producer: ", MAX_PRODUCERS);
+    if (scanf("%d %d", &nprod, &ops) != 2) { while(getchar()!='\n'); return; }
+    StressWorkload w;
+    w.ntracks = railway_ntracks(r);
+    w.nactive = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) {
+        if (!railway_train_active(r, i)) continue;
+        w.active[w.nactive++] = i;
+        for (int j = 0; j < w.ntracks; ++j) w.need[i][j] = railway_need(r, i, j);
+    }
+    if (nprod < 1 || nprod > MAX_PRODUCERS || ops < 1 || !w.nactive ||
+        (size_t)nprod * (size_t)ops > STRESS_MAX_OPS) { printf("Invalid parameters\n"); return; }
+    printf("%sConcurrent mutations (%d producers x %d ops, on a copy of the state)%s\n", C_BOLD, nprod, ops, C_RESET);
+    stress_admission(r, &w, nprod, ops, 1);
+    stress_admission(r, &w, nprod, ops, 0);
+}
+
+static void handle_region_detect(railway_t *r) {
+    int cycle[MAX_TRAINS], clen = 0, rebuilt = 0, escalated = 0;
+    long long t0 = now_ns();
+    int found = railway_detect_regions(r, cycle, &clen, &rebuilt, &escalated);
+    double us = (double)(now_ns() - t0) / 1e3;
+    if (found) print_cycle(r, cycle, clen);
+    else printf("%sNo deadlock in any region or across regions.%s\n", C_GREEN, C_RESET);
+    printf("Regions rebuilt: %d of %d, cross-region search: %s (%.1f us)\n",
+           rebuilt, railway_regions(r), escalated ? "escalated" : "not needed", us);
+}
+
+// Dashboard view of how close the system is to an unsafe state
+static void handle_margin(railway_t *r) {
+    int track;
+    int slack = railway_margin(r, &track);
+    if (slack < 0) { printf("%sState is UNSAFE: no safety margin.%s\n", C_RED, C_RESET); return; }
+    if (track < 0) printf("%sNo train is waiting on any track.%s\n", C_GREEN, C_RESET);
+    else printf("%sMinimum slack:%s %d unit(s) on %s\n", C_GREEN, C_RESET, slack, railway_track_name(r, track));
+    printf("Units removable from Available while staying safe:");
+    for (int j = 0; j < railway_ntracks(r); ++j) printf(" R%d=%d", j, railway_headroom(r, j));
+    printf("\n");
+}
+
+static void print_route(const railway_t *r, int tid) {
+    int tracks[MAX_ROUTE_STEPS], units[MAX_ROUTE_STEPS];
+    int n = railway_route(r, tid, tracks, units);
+    printf("Route of %s:", railway_train_name(r, tid));
+    if (n <= 0) printf(" (none)");
+    for (int k = 0; k < n; ++k) {
+        if (tracks[k] < 0) printf(" release-all");
+        else printf(" %s%+d", railway_track_name(r, tracks[k]), units[k]);
+    }
+    printf("\n");
+}
+
+static void handle_route(railway_t *r) {
+    int tid, n;
+    if (!read_train(r, "Enter train id or name: ", &tid)) return;
+    if (!railway_train_active(r, tid)) { printf("%sNo such train.%s\n", C_RED, C_RESET); return; }
+    print_route(r, tid);
+    printf("Number of steps in the new route (0-%d): ", MAX_ROUTE_STEPS);
+    if (scanf("%d", &n) != 1) { while(getchar()!='\n'); return; }
+    if (n < 0 || n > MAX_ROUTE_STEPS) { printf("Invalid length\n"); return; }
+    int tracks[MAX_ROUTE_STEPS], units[MAX_ROUTE_STEPS];
+    for (int k = 0; k < n; ++k) {
+        printf("Step %d: track (-1 = release all) and units (+acquire/-release): ", k);
+        if (scanf("%d %d", &tracks[k], &units[k]) != 2) { while(getchar()!='\n'); return; }
+        if (tracks[k] < -1 || tracks[k] >= railway_ntracks(r)) { printf("Invalid track\n"); return; }
+    }
+    railway_set_route(r, tid, n, tracks, units);
+    print_route(r, tid);
+}
+
+static void handle_plan_route(railway_t *r) {
+    int tid, src, dst, units, ncand;
+    if (!read_train(r, "Enter train id or name to route: ", &tid)) return;
+    if (!railway_train_active(r, tid)) { printf("%sNo such train.%s\n", C_RED, C_RESET); return; }
+    printf("From track, to track (0-%d) and units per track: ", railway_ntracks(r) - 1);
+    if (scanf("%d %d %d", &src, &dst, &units) != 3) { while(getchar()!='\n'); return; }
+    railway_route_t cand[MAX_ROUTE_CANDIDATES];
+    long long t0 = now_ns();
+    int best = railway_plan_route(r, tid, src, dst, units, cand, &ncand);
+    double us = (double)(now_ns() - t0) / 1e3;
+    for (int k = 0; k < ncand; ++k) {
+        printf("%s %d)", k == best ? "*" : " ", k + 1);
+        for (int q = 0; q < cand[k].len; ++q) printf("%s%s", q ? "-" : " ", railway_track_name(r, cand[k].track[q]));
+        if (cand[k].margin < 0) printf("  %sUNSAFE%s\n", C_RED, C_RESET);
+        else printf("  margin %d, path slack %d\n", cand[k].margin, cand[k].slack);
+    }
+    if (!ncand) printf("%sNo path between those tracks.%s\n", C_RED, C_RESET);
+    else if (best < 0) printf("%sEvery path would leave the system UNSAFE; the train must wait.%s\n", C_RED, C_RESET);
+    else print_route(r, tid);
+    printf("Routing took %.1f us for %d candidate(s)\n", us, ncand);
+}
+
+static void handle_link(railway_t *r) {
+    int a, b;
+    printf("Link which two tracks (0-%d)? ", railway_ntracks(r) - 1);
+    if (scanf("%d %d", &a, &b) != 2) { while(getchar()!='\n'); return; }
+    if (railway_link_tracks(r, a, b)) { printf("Invalid tracks\n"); return; }
+    printf("Linked %s and %s.\n", railway_track_name(r, a), railway_track_name(r, b));
+}
+
+static void handle_predict(railway_t *r) {
+    int k;
+    printf("Lookahead horizon in moves (1-%d): ", MAX_LOOKAHEAD);
+    if (scanf("%d", &k) != 1) { while(getchar()!='\n'); return; }
+    long states = 0;
+    long long t0 = now_ns();
+    int p = railway_predict(r, k, 0, &states);
+    double ms = (double)(now_ns() - t0) / 1e6;
+    if (p < 0) { printf("%sOut of working memory.%s\n", C_RED, C_RESET); return; }
+    if (p & RAILWAY_PREDICT_MUST_DEADLOCK)
+        printf("%sEvery continuation deadlocks within %d moves: intervene now.%s\n", C_RED, k, C_RESET);
+    else if (p & RAILWAY_PREDICT_CAN_DEADLOCK)
+        printf("%sSome continuations deadlock within %d moves.%s\n", C_YELLOW, k, C_RESET);
+    else if (p & RAILWAY_PREDICT_PARTIAL)
+        printf("%sNo deadlock found within %d moves before the state budget ran out.%s\n", C_YELLOW, k, C_RESET);
+    else
+        printf("%sNo deadlock reachable within %d moves.%s\n", C_GREEN, k, C_RESET);
+    printf("States explored: %ld in %.2f ms\n", states, ms);
+}
+
+static void handle_explore(railway_t *r) {
+    long budget;
+    printf("State budget (0 for the default of %d): ", RAILWAY_EXPLORE_DEFAULT_STATES);
+    if (scanf("%ld", &budget) != 1) { while(getchar()!='\n'); return; }
+    static int trace[MAX_TRACE];
+    railway_explore_t x;
+    long long t0 = now_ns();
+    if (railway_explore(r, budget, &x, trace) < 0) { printf("%sCannot allocate the state store.%s\n", C_RED, C_RESET); return; }
+    double sec = (double)(now_ns() - t0) / 1e9;
+    int ntrains = 0;
+    for (int i = 0; i < railway_ntrains(r); ++i) ntrains += railway_train_active(r, i);
+    printf("Explored %ld states, %ld transitions, depth %d in %.3f s (%.0f states/s)\n",
+           x.states, x.transitions, x.depth, sec, sec > 0 ? (double)x.states / sec : 0.0);
+    printf("Symmetry: %d trains in %d interchangeable classes\n", ntrains, x.classes);
+    if (x.deadlock) {
+        printf("%sDeadlock reachable in %d moves:%s\n", C_RED, x.trace_len, C_RESET);
+        static int tracks[MAX_TRAINS][MAX_ROUTE_STEPS], units[MAX_TRAINS][MAX_ROUTE_STEPS];
+        int step[MAX_TRAINS] = {0};
+        for (int i = 0; i < railway_ntrains(r); ++i) railway_route(r, i, tracks[i], units[i]);
+        for (int k = 0; k < x.trace_len; ++k) {
+            int tid = trace[k], q = step[tid]++;
+            int u = units[tid][q];
+            if (tracks[tid][q] < 0) printf("  %3d. %s releases everything\n", k + 1, railway_train_name(r, tid));
+            else printf("  %3d. %s %s %d unit(s) of %s\n", k + 1, railway_train_name(r, tid),
+                        u >= 0 ? "takes" : "releases", u >= 0 ? u : -u, railway_track_name(r, tracks[tid][q]));
+        }
+    } else if (x.complete) {
+        printf("%sNo interleaving of the routes reaches a deadlock.%s\n", C_GREEN, C_RESET);
+    } else {
+        printf("%sNo deadlock found before the state budget ran out.%s\n", C_YELLOW, C_RESET);
+    }
+}
+
 static void show_menu(void) {
     printf("\n%sRAILWAY MODE - MENU%s\n", C_BOLD, C_RESET);
     printf("----------------------------------\n");
@@ -632,18 +4299,30 @@ static void show_menu(void) {
     printf("9) Save checkpoint\n");
     printf("10) Restore checkpoint\n");
     printf("11) Export DOT for Graphviz\n");
+    printf("12) Benchmark safety/WFG kernels\n");
+    printf("13) Show safety margin\n");
+    printf("14) Set train route\n");
+    printf("15) Predict deadlock (route lookahead)\n");
+    printf("16) Model check all route interleavings\n");
+    printf("17) Detect deadlock by region (hierarchical)\n");
+    printf("18) Advance clock (request deadlines)\n");
+    printf("19) Set starvation limits\n");
+    printf("20) Change track capacity\n");
+    printf("21) Admit new train\n");
+    printf("22) Retire completed train\n");
+    printf("23) Revise train claim (reroute)\n");
+    printf("24) Route train over the safest path\n");
+    printf("25) Link track sections\n");
+    printf("26) Stress-test the admission thread\n");
+    printf("27) Start/stop the event log\n");
+    printf("28) Browse the state table (page/sort/filter)\n");
     printf("q) Quit\n");
     printf("Enter choice: ");
 }
 
-static void init_checkpoints(void) {
-    for (int i = 0; i < MAX_CHECKPOINTS; ++i) checkpoints[i].valid = 0;
-}
-
 int main(void) {
-    init_checkpoints();
-    sample_railway(&rail);
-    compute_need(&rail);
+    railway_t *app = railway_create();
+    if (!app) die("out of memory");
     printf("\nWelcome to the Railway Deadlock Simulator (Rail Mode)\n\n");
 
     int quit = 0;
@@ -656,46 +4335,96 @@ int main(void) {
         
         if (scanf("%s", choice) != 1) break;
 
-        if (choice[0] == '1') { 
-            sample_railway(&rail); 
-            compute_need(&rail); 
+        if (strcmp(choice, "1") == 0) { 
+            railway_load_sample(app); 
             printf("%sSample scenario loaded.%s\n\n", C_CYAN, C_RESET); 
         }
-        else if (choice[0] == '2') {
+        else if (strcmp(choice, "2") == 0) {
             int nt, nk, maxu;
             printf("Enter ntrains ntracks max_units_per_track (e.g., 6 6 2): ");
             if (scanf("%d %d %d", &nt, &nk, &maxu) == 3) { 
-                fill_random_railway(&rail, nt, nk, maxu); 
-                printf("%sRandom scenario created.%s\n\n", C_CYAN, C_RESET); 
+                if (railway_load_random(app, nt, nk, maxu, 0) == 0)
+                    printf("%sRandom scenario created.%s\n\n", C_CYAN, C_RESET); 
+                else printf("%sInvalid sizes (at most %d trains and %d tracks).%s\n\n", C_RED, MAX_TRAINS, MAX_TRACKS, C_RESET);
             }
         }
-        else if (choice[0] == '3') { 
-            manual_railway(&rail); 
-            printf("%sManual scenario set.%s\n\n", C_CYAN, C_RESET); 
+        else if (strcmp(choice, "3") == 0) { 
+            if (manual_railway(app) == 0) printf("%sManual scenario set.%s\n\n", C_CYAN, C_RESET);
         }
-        else if (choice[0] == '4') { 
-            print_state(&rail); 
+        else if (strcmp(choice, "4") == 0) { 
+            print_state(app); 
         }
-        else if (choice[0] == '5') { 
-            handle_bankers(&rail); 
+        else if (strcmp(choice, "5") == 0) { 
+            handle_bankers(app); 
         }
-        else if (choice[0] == '6') { 
-            handle_detect(&rail); 
+        else if (strcmp(choice, "6") == 0) { 
+            handle_detect(app); 
         }
-        else if (choice[0] == '7') { 
-            handle_terminate(&rail); 
+        else if (strcmp(choice, "7") == 0) { 
+            handle_terminate(app); 
         }
-        else if (choice[0] == '8') { 
-            handle_preempt(&rail); 
+        else if (strcmp(choice, "8") == 0) { 
+            handle_preempt(app); 
         }
-        else if (choice[0] == '9') { 
-            handle_save_cp(&rail); 
+        else if (strcmp(choice, "9") == 0) { 
+            handle_save_cp(app); 
         }
         else if (strcmp(choice, "10") == 0) { 
-            handle_restore_cp(&rail); 
+            handle_restore_cp(app); 
         }
         else if (strcmp(choice, "11") == 0) { 
-            handle_export(&rail); 
+            handle_export(app); 
+        }
+        else if (strcmp(choice, "12") == 0) {
+            handle_benchmark(app);
+        }
+        else if (strcmp(choice, "13") == 0) {
+            handle_margin(app);
+        }
+        else if (strcmp(choice, "14") == 0) {
+            handle_route(app);
+        }
+        else if (strcmp(choice, "15") == 0) {
+            handle_predict(app);
+        }
+        else if (strcmp(choice, "16") == 0) {
+            handle_explore(app);
+        }
+        else if (strcmp(choice, "17") == 0) {
+            handle_region_detect(app);
+        }
+        else if (strcmp(choice, "18") == 0) {
+            handle_clock(app);
+        }
+        else if (strcmp(choice, "19") == 0) {
+            handle_starvation_limits(app);
+        }
+        else if (strcmp(choice, "20") == 0) {
+            handle_capacity(app);
+        }
+        else if (strcmp(choice, "21") == 0) {
+            handle_admit(app);
+        }
+        else if (strcmp(choice, "22") == 0) {
+            handle_retire(app);
+        }
+        else if (strcmp(choice, "23") == 0) {
+            handle_revise(app);
+        }
+        else if (strcmp(choice, "24") == 0) {
+            handle_plan_route(app);
+        }
+        else if (strcmp(choice, "25") == 0) {
+            handle_link(app);
+        }
+        else if (strcmp(choice, "26") == 0) {
+            handle_admission_stress(app);
+        }
+        else if (strcmp(choice, "27") == 0) {
+            handle_event_log(app);
+        }
+        else if (strcmp(choice, "28") == 0) {
+            handle_browse_state(app);
         }
         else if (choice[0] == 'q' || choice[0] == 'Q') { 
             quit = 1; 
@@ -711,6 +4440,9 @@ int main(void) {
         // Second getchar() is to wait for the user's explicit Enter press
         getchar();
     }
+    railway_destroy(app); // Also flushes whatever the drainer has not written yet
     printf("\nGoodbye.\n");
     return 0;
 }
+
+#endif // RAILWAY_NO_MAIN
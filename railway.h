@@ -0,0 +1,241 @@
+// Railway deadlock engines as a library: Banker's avoidance, wait-for graph
+// detection, recovery, request deadlines, routing, lookahead prediction, model
+// checking, checkpoints and Graphviz export over one opaque handle.
+//
+// Every handle owns all of its state, so different handles can be used from
+// different threads at once. Calls on the same handle must not overlap; to share
+// one between threads, hold a lock around each call or run its admission thread
+// and submit requests, releases and claim revisions through it.
+// Unit rows (request, release, claim) hold one entry per track.
+//
+// Build the library object without the interactive menu:
+//   gcc -O2 -pthread -DRAILWAY_NO_MAIN -c full.c -o railway.o
+#ifndef RAILWAY_H
+#define RAILWAY_H
+
+#define RAILWAY_MAX_TRAINS 32
+#define RAILWAY_MAX_TRACKS 64
+#define RAILWAY_MAX_ROUTE_STEPS 32
+#define RAILWAY_MAX_ROUTE_CANDIDATES 10
+#define RAILWAY_MAX_TRACE (RAILWAY_MAX_TRAINS * RAILWAY_MAX_ROUTE_STEPS)
+#define RAILWAY_MAX_PRODUCERS 16
+
+// State budgets used by railway_predict and railway_explore when max_states < 1
+#define RAILWAY_PREDICT_DEFAULT_STATES 262144
+#define RAILWAY_EXPLORE_DEFAULT_STATES 1048576
+
+// railway_submit kinds
+#define RAILWAY_SUBMIT_REQUEST 0  // As railway_request
+#define RAILWAY_SUBMIT_RELEASE 1  // As railway_release
+#define RAILWAY_SUBMIT_REVISE  2  // As railway_revise_claim
+
+// railway_predict result bits
+#define RAILWAY_PREDICT_CAN_DEADLOCK  1  // Some continuation gets stuck within the horizon
+#define RAILWAY_PREDICT_MUST_DEADLOCK 2  // Every continuation gets stuck within the horizon
+#define RAILWAY_PREDICT_PARTIAL       4  // The state budget ran out before the answer was known
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct railway railway_t;
+
+// What one railway_advance_clock did
+typedef struct {
+    long retried, granted, boosted, escalated, dropped;
+    long revised;               // Deferred claim revisions applied
+} railway_clock_stats_t;
+
+// One candidate path of railway_plan_route, first track to last
+typedef struct {
+    int len;
+    int track[RAILWAY_MAX_ROUTE_STEPS - 1];   // One step is kept for the final release
+    int margin;                               // Safety margin with this claim, -1 if unsafe
+    int slack;                                // Smallest headroom on the path's own tracks
+} railway_route_t;
+
+// Outcome of railway_explore
+typedef struct {
+    long states;          // Distinct states visited
+    long transitions;
+    int depth;            // BFS levels fully expanded
+    int complete;         // 0 if the state budget ran out first
+    int deadlock;         // A stuck state is reachable
+    int trace_len;        // Length of the shortest path to it
+    int classes;          // Classes of interchangeable trains
+} railway_explore_t;
+
+// Creates a handle holding the built-in sample scenario; NULL if out of memory.
+// No call ever exits the process: failures come back as -1 or NULL.
+railway_t *railway_create(void);
+void railway_destroy(railway_t *r);
+// Independent copy of the scenario, names, checkpoints, queued requests and
+// settings; its event log starts closed. NULL if out of memory or r's
+// admission thread is running.
+railway_t *railway_clone(const railway_t *r);
+
+// Scenario loading. Each returns 0, or -1 for invalid sizes or values.
+int railway_load_sample(railway_t *r);
+// Random scenario; seed 0 picks one from the clock
+int railway_load_random(railway_t *r, int ntrains, int ntracks, int max_units_per_track, unsigned seed);
+// allocation and maximum are row-major ntrains x ntracks matrices
+int railway_load(railway_t *r, int ntrains, int ntracks, const int available[],
+                 const int allocation[], const int maximum[]);
+
+// Queries. Train ids run up to railway_ntrains(); retired ids are inactive.
+int railway_ntrains(const railway_t *r);
+int railway_ntracks(const railway_t *r);
+int railway_train_active(const railway_t *r, int tid);
+const char *railway_train_name(const railway_t *r, int tid);   // NULL if out of range
+int railway_find_train(const railway_t *r, const char *name);  // -1 if unknown
+const char *railway_track_name(const railway_t *r, int track); // NULL if out of range
+int railway_capacity(const railway_t *r, int track);          // -1 if out of range
+int railway_available(const railway_t *r, int track);         // -1 if out of range
+int railway_allocation(const railway_t *r, int tid, int track);
+int railway_need(const railway_t *r, int tid, int track);
+int railway_maximum(const railway_t *r, int tid, int track);
+// Renaming: 0, or -1 if out of range or the name table is full
+int railway_set_train_name(railway_t *r, int tid, const char *name);
+int railway_set_track_name(railway_t *r, int track, const char *name);
+
+// Banker's request: 1 granted, 0 denied (would be unsafe or must wait), -1 invalid
+int railway_request(railway_t *r, int tid, const int request[]);
+// Queues a denied request to be retried after wait (> 0) ticks. 0, or -1 if
+// invalid or the queue is full.
+int railway_queue_request(railway_t *r, int tid, const int request[], unsigned wait);
+// Advances the clock, retrying queued requests as they come due and deferred
+// claims at the end. Returns how many queued requests were granted, or -1.
+// stats (optional) receives the details.
+int railway_advance_clock(railway_t *r, unsigned ticks, railway_clock_stats_t *stats);
+unsigned railway_clock(const railway_t *r);
+int railway_pending(const railway_t *r);                 // Requests queued
+// 1 if a queued request of tid timed out after every boost and the train
+// needs recovery
+int railway_needs_recovery(const railway_t *r, int tid);
+// Hands units back (at most what the train holds); recovery preempts the same way.
+// 0 done, -1 invalid.
+int railway_release(railway_t *r, int tid, const int units[]);
+// Recovery by termination: every unit the train holds is released. 0 or -1.
+int railway_terminate(railway_t *r, int tid);
+
+// 1 if the state is safe, 0 if not. seq (optional, RAILWAY_MAX_TRAINS
+// entries) receives a safe sequence of the active trains.
+int railway_is_safe(railway_t *r, int seq[]);
+// Minimum slack of Work over Need along the safe sequence, -1 if unsafe.
+// track (optional) receives the tightest track.
+int railway_margin(railway_t *r, int *track);
+// Units of track removable from Available while the same safe sequence stays
+// valid (0 on a track of an unsafe part of the state), -1 if out of range
+int railway_headroom(railway_t *r, int track);
+// Rounds in which the trains can finish when every train whose Need fits the
+// same Work finishes together, -1 if unsafe. seq as for railway_is_safe.
+int railway_safety_rounds(railway_t *r, int seq[]);
+// Independent groups of trains and the tracks they claim
+int railway_components(railway_t *r);
+// 1 if the wait-for graph has a cycle, 0 if not, -1 if out of memory. cycle
+// (optional, RAILWAY_MAX_TRAINS entries) receives the trains on it, each waiting
+// for the next and the last for the first; *len their count.
+int railway_detect(railway_t *r, int cycle[], int *len);
+// The same verdict and cycle from per-region fragments, rebuilding only regions
+// that changed; rebuilt and escalated (optional) receive how many regions were
+// rebuilt and whether the cross-region search ran.
+int railway_detect_regions(railway_t *r, int cycle[], int *len, int *rebuilt, int *escalated);
+int railway_regions(const railway_t *r);
+// Wait-for graph: bit b of waits[a] is set if train a waits for train b.
+// waits has RAILWAY_MAX_TRAINS entries. 0, or -1 if out of memory.
+int railway_wait_graph(railway_t *r, unsigned long waits[]);
+
+// Starvation: a train is starving once its current streak of denials reaches
+// streak, or the streak has lasted wait ticks.
+int railway_set_starvation_limits(railway_t *r, int streak, unsigned wait); // 0 or -1
+void railway_starvation_limits(const railway_t *r, int *streak, unsigned *wait);
+int railway_starving(const railway_t *r, int tid);
+// Current denial streak of tid (-1 if out of range); worst (optional) receives
+// the longest streak so far and since (optional) the tick the streak began.
+int railway_denials(const railway_t *r, int tid, int *worst, unsigned *since);
+
+// Runtime changes. admit returns the new train id or -1 (refused or invalid).
+int railway_admit(railway_t *r, const int maximum[], const char *name);
+int railway_retire(railway_t *r, int tid);                             // 0 or -1
+int railway_revise_claim(railway_t *r, int tid, const int maximum[]); // 1 applied, 0 unsafe, -1 invalid
+// Keeps a revision to be retried whenever the clock advances. 0 or -1.
+int railway_defer_claim(railway_t *r, int tid, const int maximum[]);
+// Sets a track's capacity and returns the new safety verdict (1/0), or -1.
+// Lowering it below the units held is never refused: the excess is preempted
+// at once, first from the holder that still needs the most tracks (the least
+// progress lost). taken (optional, RAILWAY_MAX_TRAINS entries) receives the
+// units preempted from each train.
+int railway_set_capacity(railway_t *r, int track, int capacity, int taken[]);
+
+// Routes: a route is the list of moves a train will make, each taking units
+// (> 0) or handing back units (< 0) of a track; track -1 releases everything.
+// railway_route fills tracks[] and units[] (RAILWAY_MAX_ROUTE_STEPS entries)
+// and returns the length, -1 if tid is not active. set_route returns 0 or -1.
+int railway_route(const railway_t *r, int tid, int tracks[], int units[]);
+int railway_set_route(railway_t *r, int tid, int len, const int tracks[], const int units[]);
+// Lets trains run from track a to track b and back. 0 or -1.
+int railway_link_tracks(railway_t *r, int a, int b);
+// Scores every path from src to dst (at most RAILWAY_MAX_ROUTE_CANDIDATES, into
+// cand[] and *ncand) by the safety margin the state keeps with the train
+// claiming units on each of its tracks, and makes the best safe one the
+// train's claim and route. Returns its index, -1 if no path keeps the state safe.
+int railway_plan_route(railway_t *r, int tid, int src, int dst, int units, railway_route_t cand[], int *ncand);
+
+// Both searches stop after max_states states; max_states < 1 picks the
+// RAILWAY_*_DEFAULT_STATES budget.
+//
+// Looks horizon moves ahead along the routes (at most 12). Returns
+// RAILWAY_PREDICT_* bits, or -1 if out of memory; states (optional) receives
+// the states searched. With RAILWAY_PREDICT_PARTIAL set, CAN_DEADLOCK means a
+// deadlock was found and its absence means none was found yet; MUST_DEADLOCK
+// is never set.
+int railway_predict(railway_t *r, int horizon, long max_states, long *states);
+// Explores every interleaving of the routes (fewer states than max_states if
+// the store cannot hold them; out->complete tells). Returns 1 if a deadlock is
+// reachable, 0 if not, -1 if the state store cannot be allocated. trace
+// (optional, RAILWAY_MAX_TRACE entries) receives the train of each move on a
+// shortest path to the deadlock.
+int railway_explore(railway_t *r, long max_states, railway_explore_t *out, int trace[]);
+
+// Checkpoints: save returns the slot or -1 when all are used; restoring frees the
+// slot and drops every queued request (the clock keeps its tick)
+int railway_checkpoint_save(railway_t *r, const char *note);
+int railway_checkpoint_restore(railway_t *r, int idx);                 // 0 or -1
+const char *railway_checkpoint_note(const railway_t *r, int idx);      // NULL if unused
+
+// Writes the allocation graph and wait-for graph as Graphviz DOT. 0 or -1.
+int railway_export_dot(railway_t *r, const char *path);
+
+// Admission thread: a lock-free ring through which any number of threads submit
+// mutations that one thread applies to the handle in batches. Between start and
+// stop no call but railway_submit may touch the handle, and the track count is
+// fixed. start returns 0, or -1 if the thread is already running or cannot be
+// started. stop returns once every submitted mutation is applied, with the
+// number of batches they were applied in (-1 if the thread was not running);
+// destroying the handle stops it too.
+int railway_admission_start(railway_t *r);
+long railway_admission_stop(railway_t *r);
+// Applies one RAILWAY_SUBMIT_* mutation and waits for its result, which is that
+// of the matching call. producer (below RAILWAY_MAX_PRODUCERS) identifies the
+// calling thread; no two threads may use the same one at once. -1 if the thread
+// is not running or producer or kind is out of range.
+int railway_submit(railway_t *r, int producer, int kind, int tid, const int units[]);
+
+// Event log of this handle: every decision is appended to a ring that a
+// background thread writes to path as text (or raw records if raw). Opening
+// returns 0, or -1 if the log is already open or the file cannot be created.
+// Closing flushes the ring and returns the records written, or -1 if the log was
+// not open; dropped (optional) is increased by the records a full ring lost.
+// Destroying the handle closes its log.
+int railway_log_open(railway_t *r, const char *path, int raw);
+int railway_log_is_open(const railway_t *r);                   // 1 if open, 0 if not
+// Records waiting in the ring (queued, optional) and lost to a full ring so far
+// (dropped, optional). 0, or -1 if the log is not open.
+int railway_log_stats(const railway_t *r, long *queued, long *dropped);
+long railway_log_close(railway_t *r, long *dropped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif